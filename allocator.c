@@ -14,12 +14,18 @@
  * (Everything after this point will use your custom allocator -- be careful!)
  */
 
+#define _GNU_SOURCE /* mremap */
 #include <pthread.h>
 #include <stdbool.h>
 #include <stdint.h>
 #include <stdio.h>
 #include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <dlfcn.h>
+#include <malloc.h>
 #include <sys/mman.h>
+#include <time.h>
 #include <unistd.h>
 #include <stddef.h>
 #include <pthread.h>
@@ -30,484 +36,5464 @@
 #include "allocator.h"
 #include "logger.h"
 
-static struct mem_block *g_head = NULL; /*!< Start (head) of our linked list */
 static unsigned long g_allocations = 0; /*!< Allocation counter */
-pthread_mutex_t alloc_mutex = PTHREAD_MUTEX_INITIALIZER; /*< Mutex for protecting the linked list */
-bool scribble = false;
+bool scribble = false; /*!< Mirrors the scribble option, see g_config */
 
+/**
+ * unsigned long next_alloc_id(void)
+ *
+ * Hands out allocation IDs; safe to call without holding any arena lock.
+ *
+ * @return unsigned long   new allocation ID
+  */
+static unsigned long next_alloc_id(void)
+{
+    return __atomic_fetch_add(&g_allocations, 1, __ATOMIC_RELAXED);
+}
+
+/* -- Configuration -- */
+
+/**
+ * Every tunable is read once, as the arenas are set up (see config_load),
+ * into g_config, which is not written again after that: allocation paths
+ * only test its fields, and the free space management policy is a function
+ * pointer. Options come from ALLOCATOR_CONF, a comma separated list of
+ * key:value pairs such as "algorithm:best_fit,arenas:4,scribble:1". Each
+ * key can also be set through its own ALLOCATOR_<KEY> variable
+ * (ALLOCATOR_ALGORITHM=best_fit, ...); ALLOCATOR_CONF wins when both are set.
+ */
+#define LARGE_THRESHOLD ((size_t) 128 * 1024)
+#define LARGE_CACHE_MAX ((size_t) 64 * 1024 * 1024)
+#define SPAN_MIN ((size_t) 1024 * 1024)
+#define SPAN_MAX ((size_t) 64 * 1024 * 1024)
+#define DECAY_MS 10000
+#define HUGE_OFF 0
+#define HUGE_THP 1
+#define HUGE_TLB 2
+#define PURGE_OFF -1
+#define INDEX_BINS 0
+#define INDEX_SIZE 1
+#define INDEX_ADDRESS 2
+
+struct config {
+    /** algorithm: first_fit, best_fit, worst_fit, next_fit or buddy */
+    void *(*fit)(size_t size);
+
+    /**
+     * How free space is indexed (INDEX_*), following the algorithm: first_fit
+     * searches a tree ordered by address, best_fit and worst_fit a tree
+     * ordered by size, each in O(log n). next_fit and buddy do not search the
+     * index, so they keep the size class lists and their O(1) updates.
+     */
+    int index;
+
+    /**
+     * coalesce: freed blocks are merged with their neighbours right away
+     * ("immediate"), or, when "deferred", an arena is swept only when a fit
+     * search fails in it.
+     */
+    bool coalesce_deferred;
+
+    bool scribble;              /*!< scribble: fill new blocks with 0xAA */
+    unsigned int arenas;        /*!< arenas: number of arenas, 0 for per CPU */
+    bool tcache;                /*!< tcache: per-thread caches */
+    bool slab;                  /*!< slab: slabs for small requests */
+    size_t large_threshold;     /*!< large_threshold: bytes, 0 turns it off */
+    size_t large_cache;         /*!< large_cache: bytes of cached large regions */
+    size_t span_min;            /*!< span_min: bytes of the first span */
+    size_t span_max;            /*!< span_max: bytes, 0 maps regions on their own */
+    int hugepage;               /*!< hugepage: off, thp or hugetlb (HUGE_*) */
+    int purge;                  /*!< purge: dontneed, free or off (madvise advice) */
+    unsigned long decay_ms;     /*!< decay_ms: how long memory stays dirty */
+    bool purge_thread;          /*!< purge_thread: purge in a background thread */
+    bool stats;                 /*!< stats: print the statistics at exit */
+};
+
+static struct config g_config = {
+    .fit = first_fit,
+    .index = INDEX_ADDRESS,
+    .coalesce_deferred = false,
+    .scribble = false,
+    .arenas = 0,
+    .tcache = true,
+    .slab = true,
+    .large_threshold = LARGE_THRESHOLD,
+    .large_cache = LARGE_CACHE_MAX,
+    .span_min = SPAN_MIN,
+    .span_max = SPAN_MAX,
+    .hugepage = HUGE_OFF,
+    .purge = MADV_DONTNEED,
+    .decay_ms = DECAY_MS,
+    .purge_thread = false,
+    .stats = false,
+};
+
+/** Option keys; the legacy variable of each is ALLOCATOR_ and the key in capitals */
+static const char *const g_config_keys[] = {
+    "algorithm", "coalesce", "scribble", "arenas", "tcache", "slab",
+    "large_threshold", "large_cache", "span_min", "span_max", "hugepage",
+    "purge", "decay_ms", "purge_thread", "stats",
+};
+
+/**
+ * void config_warn(const char *key, const char *value)
+ *
+ * Reports an option that cannot be used. Writes to stderr directly, since
+ * stdio may allocate.
+ *
+ * @param key         option key
+ * @param value       rejected value
+ * @return void
+  */
+static void config_warn(const char *key, const char *value)
+{
+    char message[256];
+    int length = snprintf(message, sizeof(message),
+            "allocator: ignoring option %s:%s\n", key, value);
+    if (length > 0) {
+        write(STDERR_FILENO, message, length < (int) sizeof(message) ? length : sizeof(message) - 1);
+    }
+}
+
+/**
+ * bool config_size(const char *value, size_t *size)
+ *
+ * Parses a number of bytes (or milliseconds, or arenas).
+ *
+ * @param value       option value
+ * @param size        receives the number
+ * @return bool       false if the value is not a number
+  */
+static bool config_size(const char *value, size_t *size)
+{
+    char *end;
+    unsigned long long number = strtoull(value, &end, 10);
+    if (end == value || *end != '\0') {
+        return false;
+    }
+    *size = number;
+    return true;
+}
+
+/**
+ * bool config_flag(const char *value, bool *flag)
+ *
+ * Parses an on/off option given as 1 or 0.
+ *
+ * @param value       option value
+ * @param flag        receives the flag
+ * @return bool       false if the value is neither 0 nor 1
+  */
+static bool config_flag(const char *value, bool *flag)
+{
+    if (strcmp(value, "0") != 0 && strcmp(value, "1") != 0) {
+        return false;
+    }
+    *flag = value[0] == '1';
+    return true;
+}
+
+/**
+ * bool config_set(const char *key, const char *value)
+ *
+ * Applies one option to g_config.
+ *
+ * @param key         option key
+ * @param value       option value
+ * @return bool       false if the key or the value is not understood
+  */
+static bool config_set(const char *key, const char *value)
+{
+    size_t number;
+    if (strcmp(key, "algorithm") == 0) {
+        if (strcmp(value, "first_fit") == 0) {
+            g_config.fit = first_fit;
+        } else if (strcmp(value, "best_fit") == 0) {
+            g_config.fit = best_fit;
+        } else if (strcmp(value, "worst_fit") == 0) {
+            g_config.fit = worst_fit;
+        } else if (strcmp(value, "next_fit") == 0) {
+            g_config.fit = next_fit;
+        } else if (strcmp(value, "buddy") == 0) {
+            g_config.fit = buddy_fit;
+        } else {
+            return false;
+        }
+        if (g_config.fit == first_fit) {
+            g_config.index = INDEX_ADDRESS;
+        } else if (g_config.fit == best_fit || g_config.fit == worst_fit) {
+            g_config.index = INDEX_SIZE;
+        } else {
+            g_config.index = INDEX_BINS;
+        }
+    } else if (strcmp(key, "coalesce") == 0) {
+        if (strcmp(value, "immediate") != 0 && strcmp(value, "deferred") != 0) {
+            return false;
+        }
+        g_config.coalesce_deferred = strcmp(value, "deferred") == 0;
+    } else if (strcmp(key, "scribble") == 0) {
+        return config_flag(value, &g_config.scribble);
+    } else if (strcmp(key, "arenas") == 0) {
+        if (!config_size(value, &number)) {
+            return false;
+        }
+        g_config.arenas = number < UINT_MAX ? number : UINT_MAX;
+    } else if (strcmp(key, "tcache") == 0) {
+        return config_flag(value, &g_config.tcache);
+    } else if (strcmp(key, "slab") == 0) {
+        return config_flag(value, &g_config.slab);
+    } else if (strcmp(key, "large_threshold") == 0) {
+        if (!config_size(value, &number)) {
+            return false;
+        }
+        g_config.large_threshold = number == 0 ? SIZE_MAX : number;
+    } else if (strcmp(key, "large_cache") == 0) {
+        return config_size(value, &g_config.large_cache);
+    } else if (strcmp(key, "span_min") == 0) {
+        return config_size(value, &g_config.span_min);
+    } else if (strcmp(key, "span_max") == 0) {
+        return config_size(value, &g_config.span_max);
+    } else if (strcmp(key, "hugepage") == 0) {
+        if (strcmp(value, "off") == 0) {
+            g_config.hugepage = HUGE_OFF;
+        } else if (strcmp(value, "thp") == 0) {
+            g_config.hugepage = HUGE_THP;
+        } else if (strcmp(value, "hugetlb") == 0) {
+            g_config.hugepage = HUGE_TLB;
+        } else {
+            return false;
+        }
+    } else if (strcmp(key, "purge") == 0) {
+        if (strcmp(value, "dontneed") == 0) {
+            g_config.purge = MADV_DONTNEED;
+        } else if (strcmp(value, "free") == 0) {
+            g_config.purge = MADV_FREE;
+        } else if (strcmp(value, "off") == 0) {
+            g_config.purge = PURGE_OFF;
+        } else {
+            return false;
+        }
+    } else if (strcmp(key, "decay_ms") == 0) {
+        if (!config_size(value, &number)) {
+            return false;
+        }
+        g_config.decay_ms = number;
+    } else if (strcmp(key, "purge_thread") == 0) {
+        return config_flag(value, &g_config.purge_thread);
+    } else if (strcmp(key, "stats") == 0) {
+        return config_flag(value, &g_config.stats);
+    } else {
+        return false;
+    }
+    return true;
+}
+
+/**
+ * void config_load(void)
+ *
+ * Reads the legacy ALLOCATOR_<KEY> variables, then ALLOCATOR_CONF, into
+ * g_config. Called once, before any arena is used.
+ *
+ * @return void
+  */
+static void config_load(void)
+{
+    for (size_t i = 0; i < sizeof(g_config_keys) / sizeof(g_config_keys[0]); i++) {
+        char name[64] = "ALLOCATOR_";
+        size_t length = strlen(name);
+        for (const char *c = g_config_keys[i]; *c != '\0'; c++) {
+            name[length++] = *c >= 'a' && *c <= 'z' ? *c - 'a' + 'A' : *c;
+        }
+        name[length] = '\0';
+        char *value = getenv(name);
+        if (value != NULL && !config_set(g_config_keys[i], value)) {
+            config_warn(g_config_keys[i], value);
+        }
+    }
+    const char *conf = getenv("ALLOCATOR_CONF");
+    while (conf != NULL && *conf != '\0') {
+        /* copy one key:value item, so both halves can be NUL terminated */
+        char item[128];
+        size_t length = strcspn(conf, ",");
+        size_t copied = length < sizeof(item) - 1 ? length : sizeof(item) - 1;
+        memcpy(item, conf, copied);
+        item[copied] = '\0';
+        conf += conf[length] == ',' ? length + 1 : length;
+        if (copied == 0) {
+            continue;
+        }
+        char *value = strchr(item, ':');
+        if (value == NULL) {
+            config_warn(item, "");
+            continue;
+        }
+        *value++ = '\0';
+        if (!config_set(item, value)) {
+            config_warn(item, value);
+        }
+    }
+    if (g_config.span_min > g_config.span_max) {
+        g_config.span_min = g_config.span_max;
+    }
+}
+
+/* -- Statistics -- */
+
+/**
+ * Counters are always kept, in a shard per thread that only its thread
+ * writes, so counting costs a thread-local add and no atomic operation. A
+ * thread's shard is linked into g_stats_shards when the thread is bound to
+ * an arena; allocator_stats_get() sums the linked shards under
+ * g_stats_lock. When a thread exits, its shard is folded into
+ * g_stats_retired, which also takes, under the lock, anything the thread
+ * counts afterwards. Shards may hold negative amounts, e.g. bytes freed by a
+ * thread that did not allocate them; the sums come out right modulo 2^64.
+ */
+enum stats_state {
+    STATS_UNLINKED = 0,
+    STATS_LINKED,
+    STATS_RETIRED,
+};
+
+struct stats_shard {
+    struct allocator_stats counters;
+    enum stats_state state;
+    struct stats_shard *next;
+    struct stats_shard *prev;
+};
+
+static pthread_mutex_t g_stats_lock = PTHREAD_MUTEX_INITIALIZER; /*!< Protects the two below */
+static struct stats_shard *g_stats_shards = NULL; /*!< Shards of live threads */
+static struct allocator_stats g_stats_retired; /*!< Counts of exited threads */
+static __thread struct stats_shard t_stats __attribute__((tls_model("initial-exec")));
+
+/** Every field of struct allocator_stats is a size_t counter */
+#define STATS_FIELDS (sizeof(struct allocator_stats) / sizeof(size_t))
+
+/**
+ * void stats_retired_add(size_t offset, size_t n)
+ *
+ * Adds to the counter at 'offset' in g_stats_retired, for threads that have
+ * retired their shard.
+ *
+ * @param offset      byte offset of the counter in struct allocator_stats
+ * @param n           amount, wrapping for subtractions
+ * @return void
+  */
+static void stats_retired_add(size_t offset, size_t n)
+{
+    pthread_mutex_lock(&g_stats_lock);
+    *(size_t *) ((char *) &g_stats_retired + offset) += n;
+    pthread_mutex_unlock(&g_stats_lock);
+}
+
+/**
+ * Adds n to a counter of the calling thread's shard, or of g_stats_retired
+ * once the thread has retired its shard. Readers load the shards of other
+ * threads, hence the relaxed atomic accesses, which compile to plain loads
+ * and stores. A macro, so that unoptimized builds pay no call either.
+ */
+#define STATS_ADD(field, n) do { \
+    if (t_stats.state != STATS_RETIRED) { \
+        size_t *counter_ = &t_stats.counters.field; \
+        __atomic_store_n(counter_, __atomic_load_n(counter_, __ATOMIC_RELAXED) + (n), \
+                __ATOMIC_RELAXED); \
+    } else { \
+        stats_retired_add(offsetof(struct allocator_stats, field), (n)); \
+    } \
+} while (0)
+
+/**
+ * int stats_class(size_t size)
+ *
+ * Size class of a block for the per class counters.
+ *
+ * @param size        usable bytes
+ * @return int        class: up to 16 << class bytes
+  */
+static inline int stats_class(size_t size)
+{
+    if (size <= 16) {
+        return 0;
+    }
+    int class = 64 - __builtin_clzl(size - 1) - 4;
+    return class < ALLOCATOR_STATS_CLASSES ? class : ALLOCATOR_STATS_CLASSES - 1;
+}
+
+/**
+ * void stats_alloc(size_t size)
+ *
+ * Counts an allocation handed to the caller.
+ *
+ * @param size        usable bytes
+ * @return void
+  */
+static inline void stats_alloc(size_t size)
+{
+    STATS_ADD(allocs[stats_class(size)], 1);
+    STATS_ADD(in_use, size);
+}
+
+/**
+ * void stats_free(size_t size)
+ *
+ * Counts an allocation given back by the caller.
+ *
+ * @param size        usable bytes
+ * @return void
+  */
+static inline void stats_free(size_t size)
+{
+    STATS_ADD(frees[stats_class(size)], 1);
+    STATS_ADD(in_use, -size);
+}
+
+/**
+ * void stats_map(size_t size)
+ *
+ * Counts an mmap() or mremap() call and the bytes it made accessible.
+ *
+ * @param size        bytes mapped
+ * @return void
+  */
+static void stats_map(size_t size)
+{
+    STATS_ADD(mmaps, 1);
+    STATS_ADD(mapped, size);
+}
+
+/**
+ * void stats_unmap(size_t size)
+ *
+ * Counts an munmap() call and the bytes it removed.
+ *
+ * @param size        bytes unmapped
+ * @return void
+  */
+static void stats_unmap(size_t size)
+{
+    STATS_ADD(munmaps, 1);
+    STATS_ADD(mapped, -size);
+}
+
+/**
+ * void stats_link(void)
+ *
+ * Makes the calling thread's shard visible to allocator_stats_get().
+ *
+ * @return void
+  */
+static void stats_link(void)
+{
+    if (t_stats.state != STATS_UNLINKED) {
+        return;
+    }
+    pthread_mutex_lock(&g_stats_lock);
+    t_stats.next = g_stats_shards;
+    t_stats.prev = NULL;
+    if (g_stats_shards != NULL) {
+        g_stats_shards->prev = &t_stats;
+    }
+    g_stats_shards = &t_stats;
+    t_stats.state = STATS_LINKED;
+    pthread_mutex_unlock(&g_stats_lock);
+}
+
+/**
+ * void stats_retire(void)
+ *
+ * Folds an exiting thread's shard into g_stats_retired and unlinks it.
+ *
+ * @return void
+  */
+static void stats_retire(void)
+{
+    pthread_mutex_lock(&g_stats_lock);
+    size_t *from = (size_t *) &t_stats.counters;
+    size_t *to = (size_t *) &g_stats_retired;
+    for (size_t i = 0; i < STATS_FIELDS; i++) {
+        to[i] += from[i];
+    }
+    if (t_stats.state == STATS_LINKED) {
+        if (t_stats.prev != NULL) {
+            t_stats.prev->next = t_stats.next;
+        } else {
+            g_stats_shards = t_stats.next;
+        }
+        if (t_stats.next != NULL) {
+            t_stats.next->prev = t_stats.prev;
+        }
+    }
+    t_stats.state = STATS_RETIRED;
+    pthread_mutex_unlock(&g_stats_lock);
+}
+
+/* -- Free space index -- */
+
+/**
+ * Free space is binned into segregated size classes. Each power of two is
+ * split into BIN_SUBCLASSES geometric classes, and a bitmap keeps one bit per
+ * class so the first non-empty class at or above a size is found with a couple
+ * of bit scans instead of a walk over the block list.
+ */
+#define BIN_SUBCLASS_BITS 2
+#define BIN_SUBCLASSES (1 << BIN_SUBCLASS_BITS)
+#define BIN_MIN_SHIFT 5 /* smallest block: a compact header with no data */
+#define BIN_COUNT ((64 - BIN_MIN_SHIFT) * BIN_SUBCLASSES)
+#define BIN_WORDS ((BIN_COUNT + 63) / 64)
+
+/**
+ * Index entry for the free space of a block. It is stored inside the free
+ * space it describes: right after the used part of the block, or after the
+ * header when the whole block is free. The entry sits on a size class list
+ * or in a red-black tree: keyed by free space then block address when
+ * best_fit/worst_fit pick the size tree, or by block address alone for
+ * first_fit, each node then also recording the largest free space below it.
+ */
+struct free_extent {
+    union {
+        struct {
+            struct free_extent *next;
+            struct free_extent *prev;
+        };
+        struct {
+            struct free_extent *left;   /*!< Trees: smaller keys */
+            struct free_extent *right;  /*!< Trees: larger keys */
+        };
+    };
+    struct mem_block *block;    /*!< Block owning this free space */
+    uintptr_t parent_color;     /*!< Trees: parent, red flag in bit 0 */
+    size_t space;               /*!< Size tree: free space when indexed;
+                                     address tree: largest in the subtree */
+};
+
+/** Offset of the free_extent inside a block that is entirely free */
+#define EXTENT_OFFSET ((sizeof(struct mem_block) + 7) & ~(size_t) 7)
+
+/** Smallest free space worth indexing: a header plus one aligned byte */
+#define MIN_EXTENT ((sizeof(struct mem_block) + 1 + 7) & ~(size_t) 7)
+
+/* -- Regions -- */
+
+/**
+ * Bookkeeping for one mapped region. Descriptors live outside the mappings
+ * (see meta_alloc) and every block points at its region's descriptor, so
+ * free() can update the live-block count and unlink an empty region without
+ * walking any list.
+ */
+struct span;
+
+struct region {
+    struct region *next;        /*!< Next region of the arena */
+    struct region *prev;        /*!< Previous region of the arena */
+    struct arena *arena;        /*!< Arena owning the region */
+    struct mem_block *start;    /*!< First block, at the start of the mapping */
+    size_t size;                /*!< Size of the mapping */
+    size_t live;                /*!< Blocks in the region that are in use */
+    unsigned int order;         /*!< Buddy tree order, 0 for regular regions */
+    bool large;                 /*!< Dedicated to one large block, never indexed */
+    struct span *span;          /*!< Span the region was carved from, if any */
+    unsigned char huge;         /*!< HUGE_* mode backing the region, HUGE_OFF if none */
+    unsigned long idle_since;   /*!< When a large region was cached, in ms */
+};
+
+#define META_CHUNK (64 * 1024)
+
+static pthread_mutex_t g_meta_lock = PTHREAD_MUTEX_INITIALIZER; /*!< Protects the metadata pool */
+static void *g_meta_cursor = NULL; /*!< Bump pointer into the current metadata chunk */
+static size_t g_meta_left = 0; /*!< Bytes left in the current metadata chunk */
+static struct region *g_free_regions = NULL; /*!< Recycled region descriptors */
+
+/**
+ * void *meta_alloc(size_t size)
+ *
+ * Carves allocator metadata out of chunks mapped for that purpose, so that
+ * bookkeeping never recurses into malloc. Must be called with g_meta_lock
+ * held. Metadata memory is recycled by its users, never unmapped.
+ *
+ * @param size        bytes needed (rounded up to 16)
+ * @return void       metadata pointer, or NULL if mapping failed
+  */
+static void *meta_alloc(size_t size)
+{
+    size = (size + 15) & ~(size_t) 15;
+    if (size > g_meta_left) {
+        size_t chunk = size > META_CHUNK ? size : META_CHUNK;
+        void *mem = mmap(NULL, chunk, PROT_READ | PROT_WRITE,
+                MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+        if (mem == MAP_FAILED) {
+            perror("mmap error");
+            return NULL;
+        }
+        stats_map(chunk);
+        g_meta_cursor = mem;
+        g_meta_left = chunk;
+    }
+    void *ptr = g_meta_cursor;
+    g_meta_cursor += size;
+    g_meta_left -= size;
+    return ptr;
+}
+
+/**
+ * struct region *region_new(void)
+ *
+ * Gets a zeroed region descriptor.
+ *
+ * @return region     descriptor, or NULL if out of memory
+  */
+static struct region *region_new(void)
+{
+    pthread_mutex_lock(&g_meta_lock);
+    struct region *region = g_free_regions;
+    if (region != NULL) {
+        g_free_regions = region->next;
+    } else {
+        region = meta_alloc(sizeof(struct region));
+    }
+    pthread_mutex_unlock(&g_meta_lock);
+    if (region != NULL) {
+        memset(region, 0, sizeof(struct region));
+    }
+    return region;
+}
+
+/**
+ * void region_delete(struct region *region)
+ *
+ * Recycles a region descriptor once its mapping is gone.
+ *
+ * @param region      descriptor
+ * @return void
+  */
+static void region_delete(struct region *region)
+{
+    pthread_mutex_lock(&g_meta_lock);
+    region->next = g_free_regions;
+    g_free_regions = region;
+    pthread_mutex_unlock(&g_meta_lock);
+}
+
+/**
+ * bool region_indexed(struct region *region)
+ *
+ * Tells whether a region's free space is kept in the free space index:
+ * buddy regions and large regions manage theirs themselves.
+ *
+ * @param region      region
+ * @return bool       true for regular regions
+  */
+static inline bool region_indexed(struct region *region)
+{
+    return region->order == 0 && !region->large;
+}
+
+/* -- Page map -- */
+
+/**
+ * A three-level radix tree maps every page of a region to the region's
+ * descriptor, so free(), realloc() and malloc_usable_size() can tell in
+ * constant time whether a pointer lies in memory this allocator handed out.
+ * Each level resolves PAGEMAP_BITS bits of a 48-bit address. Interior nodes
+ * come from the metadata pool and are never freed, so readers need no lock.
+ * Entries are set when a region gets its memory and cleared before the
+ * memory is given back. Bump arena chunks are not entered.
+ */
+#define PAGEMAP_SHIFT 12
+#define PAGEMAP_BITS 12
+#define PAGEMAP_FANOUT ((uintptr_t) 1 << PAGEMAP_BITS)
+
+struct pagemap_leaf {
+    struct region *regions[PAGEMAP_FANOUT];
+};
+
+struct pagemap_node {
+    struct pagemap_leaf *leaves[PAGEMAP_FANOUT];
+};
+
+static struct pagemap_node *g_pagemap[PAGEMAP_FANOUT];
+
+/**
+ * struct pagemap_leaf *pagemap_leaf(uintptr_t page, bool create)
+ *
+ * Finds the leaf holding a page's entry, creating the missing nodes on the
+ * way if asked to.
+ *
+ * @param page        page number
+ * @param create      add missing nodes
+ * @return leaf       leaf node, or NULL
+  */
+static struct pagemap_leaf *pagemap_leaf(uintptr_t page, bool create)
+{
+    if (page >> (3 * PAGEMAP_BITS) != 0) {
+        return NULL;
+    }
+    struct pagemap_node **root = &g_pagemap[page >> (2 * PAGEMAP_BITS)];
+    struct pagemap_node *node = __atomic_load_n(root, __ATOMIC_ACQUIRE);
+    struct pagemap_leaf **slot = NULL;
+    if (node != NULL) {
+        slot = &node->leaves[(page >> PAGEMAP_BITS) & (PAGEMAP_FANOUT - 1)];
+        struct pagemap_leaf *leaf = __atomic_load_n(slot, __ATOMIC_ACQUIRE);
+        if (leaf != NULL || !create) {
+            return leaf;
+        }
+    } else if (!create) {
+        return NULL;
+    }
+    pthread_mutex_lock(&g_meta_lock);
+    node = *root;
+    if (node == NULL) {
+        node = meta_alloc(sizeof(struct pagemap_node));
+        if (node == NULL) {
+            pthread_mutex_unlock(&g_meta_lock);
+            return NULL;
+        }
+        __atomic_store_n(root, node, __ATOMIC_RELEASE);
+    }
+    slot = &node->leaves[(page >> PAGEMAP_BITS) & (PAGEMAP_FANOUT - 1)];
+    struct pagemap_leaf *leaf = *slot;
+    if (leaf == NULL) {
+        leaf = meta_alloc(sizeof(struct pagemap_leaf));
+        if (leaf != NULL) {
+            __atomic_store_n(slot, leaf, __ATOMIC_RELEASE);
+        }
+    }
+    pthread_mutex_unlock(&g_meta_lock);
+    return leaf;
+}
+
+/**
+ * bool pagemap_set(void *base, size_t size, struct region *region)
+ *
+ * Points the entries of every page in a range at a region, or clears them
+ * when region is NULL. Metadata chunks are fresh mappings, so new nodes are
+ * already clear.
+ *
+ * @param base        start of the range, page aligned
+ * @param size        length of the range
+ * @param region      region descriptor, or NULL
+ * @return bool       false if a node could not be added
+  */
+static bool pagemap_set(void *base, size_t size, struct region *region)
+{
+    uintptr_t page = (uintptr_t) base >> PAGEMAP_SHIFT;
+    uintptr_t end = (((uintptr_t) base + size - 1) >> PAGEMAP_SHIFT) + 1;
+    while (page < end) {
+        uintptr_t stop = (page | (PAGEMAP_FANOUT - 1)) + 1; /* end of this leaf */
+        stop = stop < end ? stop : end;
+        struct pagemap_leaf *leaf = pagemap_leaf(page, region != NULL);
+        if (leaf == NULL) {
+            if (region != NULL) {
+                return false;
+            }
+            page = stop;
+            continue;
+        }
+        for (; page < stop; page++) {
+            __atomic_store_n(&leaf->regions[page & (PAGEMAP_FANOUT - 1)], region, __ATOMIC_RELAXED);
+        }
+    }
+    return true;
+}
+
+/**
+ * struct region *pagemap_get(void *ptr)
+ *
+ * Finds the region a data pointer lies in. The byte before the data is part
+ * of the block's header and always inside the region, even for a block
+ * that ends where its region does.
+ *
+ * @param ptr         data pointer
+ * @return region     region descriptor, or NULL if the pointer is not ours
+  */
+static inline struct region *pagemap_get(void *ptr)
+{
+    uintptr_t page = ((uintptr_t) ptr - 1) >> PAGEMAP_SHIFT;
+    struct pagemap_leaf *leaf = pagemap_leaf(page, false);
+    if (leaf == NULL) {
+        return NULL;
+    }
+    return __atomic_load_n(&leaf->regions[page & (PAGEMAP_FANOUT - 1)], __ATOMIC_RELAXED);
+}
+
+/* -- Block headers -- */
+
+/**
+ * Header fields that differ between the two header layouts are only touched
+ * through the helpers below. The compact header keeps BLOCK_* flags in the low
+ * bits of 'size' and has no region pointer: regions are mapped REGION_ALIGN
+ * aligned with a pointer to their descriptor in the REGION_PROLOGUE at the
+ * base, and every block header lies within the first REGION_ALIGN bytes of
+ * its region, so masking a header's address finds the descriptor.
+ */
+#if ALLOCATOR_COMPACT_HEADER
+#define BLOCK_ALIGN 16
+#define BLOCK_FLAGS ((size_t) 0xf)
+#define BLOCK_NAMED ((size_t) 0x1) /*!< The block has an entry in the name table */
+#define REGION_ALIGN ((size_t) 64 * 1024)
+#define REGION_PROLOGUE 16
+#define DATA_ALIGN 16 /*!< Alignment every data pointer has */
+#else
+#define BLOCK_ALIGN 8
+#define REGION_PROLOGUE 0
+#define DATA_ALIGN 4 /*!< Alignment every data pointer has: 100-byte headers */
+#endif
+
+/**
+ * size_t block_size(struct mem_block *block)
+ *
+ * Reads a block's size without its flags.
+ *
+ * @param block       memory block
+ * @return size_t     block size
+  */
+static inline size_t block_size(struct mem_block *block)
+{
+#if ALLOCATOR_COMPACT_HEADER
+    return __atomic_load_n(&block->size, __ATOMIC_RELAXED) & ~BLOCK_FLAGS;
+#else
+    return block->size;
+#endif
+}
+
+/**
+ * void block_set_size(struct mem_block *block, size_t size)
+ *
+ * Resizes a block, keeping its flags. The owner of a compact header may flip
+ * its flags without the arena lock, so the size is moved by an atomic add,
+ * which never carries into the flag bits.
+ *
+ * @param block       memory block
+ * @param size        new size
+ * @return void
+  */
+static inline void block_set_size(struct mem_block *block, size_t size)
+{
+#if ALLOCATOR_COMPACT_HEADER
+    __atomic_fetch_add(&block->size, size - block_size(block), __ATOMIC_RELAXED);
+#else
+    block->size = size;
+#endif
+}
+
+/**
+ * void block_init(struct mem_block *block, size_t size, struct region *region)
+ *
+ * Fills in the layout-specific fields of a new block header.
+ *
+ * @param block       new block
+ * @param size        block size
+ * @param region      region the block lies in
+ * @return void
+  */
+static inline void block_init(struct mem_block *block, size_t size, struct region *region)
+{
+    block->size = size;
+#if !ALLOCATOR_COMPACT_HEADER
+    block->region_start = region->start;
+    block->region_size = region->size;
+    block->region = region;
+#endif
+}
+
+/**
+ * struct region *block_region(struct mem_block *block)
+ *
+ * Finds the region a block lies in.
+ *
+ * @param block       memory block
+ * @return region     region descriptor
+  */
+static inline struct region *block_region(struct mem_block *block)
+{
+#if ALLOCATOR_COMPACT_HEADER
+    return *(struct region **) ((uintptr_t) block & ~(REGION_ALIGN - 1));
+#else
+    return block->region;
+#endif
+}
+
+/**
+ * void *region_base(struct region *region)
+ *
+ * Start of a region's mapping (its first block follows the prologue).
+ *
+ * @param region      region descriptor
+ * @return void       mapping address
+  */
+static inline void *region_base(struct region *region)
+{
+    return (void *) region->start - REGION_PROLOGUE;
+}
+
+/**
+ * void block_set_id(struct mem_block *block)
+ *
+ * Gives a block handed out by the heap a new allocation ID. Compact headers
+ * have no room for one; named blocks get theirs in the name table.
+ *
+ * @param block       memory block
+ * @return void
+  */
+static inline void block_set_id(struct mem_block *block)
+{
+#if !ALLOCATOR_COMPACT_HEADER
+    block->alloc_id = next_alloc_id();
+#endif
+}
+
+#if ALLOCATOR_COMPACT_HEADER
+
+/**
+ * With the compact header, names are kept in an open-addressing hash table
+ * keyed by block address. Only blocks named through malloc_name() get an
+ * entry (and the BLOCK_NAMED flag), so plain malloc()/free() never touch it.
+ */
+struct name_entry {
+    struct mem_block *block;    /*!< Named block, NULL for an empty slot */
+    unsigned long alloc_id;
+    char name[32];
+};
+
+static pthread_mutex_t g_names_lock = PTHREAD_MUTEX_INITIALIZER; /*!< Protects the name table */
+static struct name_entry *g_names = NULL;
+static size_t g_names_capacity = 0; /*!< Slots in the table, a power of two */
+static size_t g_names_used = 0;
+
+/**
+ * size_t name_home(struct mem_block *block)
+ *
+ * Hashes a block address to its preferred slot in the name table.
+ *
+ * @param block       memory block
+ * @return size_t     slot index
+  */
+static size_t name_home(struct mem_block *block)
+{
+    return (((uintptr_t) block >> 4) * 0x9E3779B97F4A7C15UL >> 16)
+        & (g_names_capacity - 1);
+}
+
+/**
+ * struct name_entry *name_find(struct mem_block *block)
+ *
+ * Looks a block up in the name table. Must be called with g_names_lock held.
+ *
+ * @param block       memory block
+ * @return entry      the block's entry, or NULL
+  */
+static struct name_entry *name_find(struct mem_block *block)
+{
+    if (g_names_capacity == 0) {
+        return NULL;
+    }
+    for (size_t i = name_home(block); g_names[i].block != NULL;
+            i = (i + 1) & (g_names_capacity - 1)) {
+        if (g_names[i].block == block) {
+            return &g_names[i];
+        }
+    }
+    return NULL;
+}
+
+/**
+ * bool name_grow(void)
+ *
+ * Doubles the name table. Must be called with g_names_lock held.
+ *
+ * @return bool       false if the new table could not be mapped
+  */
+static bool name_grow(void)
+{
+    size_t capacity = g_names_capacity == 0 ? 256 : g_names_capacity * 2;
+    struct name_entry *table = mmap(NULL, capacity * sizeof(struct name_entry),
+            PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    if (table == MAP_FAILED) {
+        perror("mmap error");
+        return false;
+    }
+    stats_map(capacity * sizeof(struct name_entry));
+    struct name_entry *old = g_names;
+    size_t old_capacity = g_names_capacity;
+    g_names = table;
+    g_names_capacity = capacity;
+    for (size_t i = 0; i < old_capacity; i++) {
+        if (old[i].block != NULL) {
+            size_t j = name_home(old[i].block);
+            while (table[j].block != NULL) {
+                j = (j + 1) & (capacity - 1);
+            }
+            table[j] = old[i];
+        }
+    }
+    if (old != NULL) {
+        munmap(old, old_capacity * sizeof(struct name_entry));
+        stats_unmap(old_capacity * sizeof(struct name_entry));
+    }
+    return true;
+}
+
+/**
+ * void name_set(struct mem_block *block, const char *name)
+ *
+ * Records a name and a new allocation ID for a block.
+ *
+ * @param block       memory block owned by the caller
+ * @param name        block name
+ * @return void
+  */
+static void name_set(struct mem_block *block, const char *name)
+{
+    pthread_mutex_lock(&g_names_lock);
+    if ((g_names_used + 1) * 4 > g_names_capacity * 3 && !name_grow()) {
+        pthread_mutex_unlock(&g_names_lock);
+        return;
+    }
+    size_t i = name_home(block);
+    while (g_names[i].block != NULL) {
+        i = (i + 1) & (g_names_capacity - 1);
+    }
+    g_names[i].block = block;
+    g_names[i].alloc_id = next_alloc_id();
+    strncpy(g_names[i].name, name, sizeof(g_names[i].name) - 1);
+    g_names[i].name[sizeof(g_names[i].name) - 1] = '\0';
+    g_names_used++;
+    LOG("ALLOCATION ID: %lu\n", g_names[i].alloc_id);
+    pthread_mutex_unlock(&g_names_lock);
+    __atomic_fetch_or(&block->size, BLOCK_NAMED, __ATOMIC_RELAXED);
+}
+
+/**
+ * void name_clear(struct mem_block *block)
+ *
+ * Drops a freed block's name, if it has one. Later entries of the probe
+ * sequence are shifted back so that lookups never need tombstones.
+ *
+ * @param block       block being freed
+ * @return void
+  */
+static void name_clear(struct mem_block *block)
+{
+    if ((__atomic_load_n(&block->size, __ATOMIC_RELAXED) & BLOCK_NAMED) == 0) {
+        return;
+    }
+    __atomic_fetch_and(&block->size, ~BLOCK_NAMED, __ATOMIC_RELAXED);
+    pthread_mutex_lock(&g_names_lock);
+    struct name_entry *entry = name_find(block);
+    if (entry != NULL) {
+        size_t mask = g_names_capacity - 1;
+        size_t hole = entry - g_names;
+        for (size_t i = (hole + 1) & mask; g_names[i].block != NULL; i = (i + 1) & mask) {
+            size_t home = name_home(g_names[i].block);
+            if (((i - home) & mask) >= ((i - hole) & mask)) {
+                g_names[hole] = g_names[i];
+                hole = i;
+            }
+        }
+        g_names[hole].block = NULL;
+        g_names_used--;
+    }
+    pthread_mutex_unlock(&g_names_lock);
+}
+
+#endif
+
+/**
+ * void block_label(struct mem_block *block, unsigned long *alloc_id, char *name)
+ *
+ * Copies out a block's allocation ID and name for the memory dump. Unnamed
+ * compact blocks are reported with ID 0 and an empty name.
+ *
+ * @param block       memory block
+ * @param alloc_id    receives the allocation ID
+ * @param name        receives the name (32 bytes)
+ * @return void
+  */
+static void block_label(struct mem_block *block, unsigned long *alloc_id, char *name)
+{
+#if ALLOCATOR_COMPACT_HEADER
+    *alloc_id = 0;
+    name[0] = '\0';
+    if ((block->size & BLOCK_NAMED) == 0) {
+        return;
+    }
+    pthread_mutex_lock(&g_names_lock);
+    struct name_entry *entry = name_find(block);
+    if (entry != NULL) {
+        *alloc_id = entry->alloc_id;
+        memcpy(name, entry->name, sizeof(entry->name));
+    }
+    pthread_mutex_unlock(&g_names_lock);
+#else
+    *alloc_id = block->alloc_id;
+    memcpy(name, block->name, sizeof(block->name));
+#endif
+}
+
+/**
+ * Prefix of the names given to blocks allocated without one.
+ */
+#define AUTO_NAME "ALOCATOR "
+
+/**
+ * bool block_named(struct mem_block *block)
+ *
+ * Tells whether a block was named through malloc_name(). Such blocks stay out
+ * of the thread caches, so print_memory() shows them as the program left them.
+ *
+ * @param block       memory block
+ * @return bool       true for a named block
+  */
+static bool block_named(struct mem_block *block)
+{
+#if ALLOCATOR_COMPACT_HEADER
+    return (__atomic_load_n(&block->size, __ATOMIC_RELAXED) & BLOCK_NAMED) != 0;
+#else
+    return strncmp(block->name, AUTO_NAME, sizeof(AUTO_NAME) - 1) != 0;
+#endif
+}
+
+/**
+ * void *map_aligned(size_t size, size_t align)
+ *
+ * Maps anonymous memory at an 'align'-aligned address. A plain mapping is
+ * tried first; if it is misaligned, a larger one is made and trimmed.
+ *
+ * @param size        bytes to map, a multiple of the page size
+ * @param align       alignment, a power of two
+ * @return void       mapping, or NULL if mmap failed
+  */
+static void *map_aligned(size_t size, size_t align)
+{
+    void *mem = mmap(NULL, size, PROT_READ | PROT_WRITE,
+            MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    if (mem == MAP_FAILED) {
+        perror("mmap error");
+        return NULL;
+    }
+    stats_map(size);
+    if (((uintptr_t) mem & (align - 1)) == 0) {
+        return mem;
+    }
+    munmap(mem, size);
+    stats_unmap(size);
+    size_t span = size + align - getpagesize();
+    mem = mmap(NULL, span, PROT_READ | PROT_WRITE,
+            MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    if (mem == MAP_FAILED) {
+        perror("mmap error");
+        return NULL;
+    }
+    stats_map(span);
+    void *aligned = (void *) (((uintptr_t) mem + align - 1) & ~(align - 1));
+    if (aligned != mem) {
+        munmap(mem, aligned - mem);
+        stats_unmap(aligned - mem);
+    }
+    if (aligned + size != mem + span) {
+        munmap(aligned + size, mem + span - (aligned + size));
+        stats_unmap(mem + span - (aligned + size));
+    }
+    return aligned;
+}
+
+/* -- Huge pages -- */
+
+/**
+ * ALLOCATOR_HUGEPAGE=thp maps spans and large regions HUGE_PAGE aligned, in
+ * whole huge pages, and advises the kernel to back them with transparent
+ * huge pages (MADV_HUGEPAGE), which takes effect when THP is set to
+ * "madvise". ALLOCATOR_HUGEPAGE=hugetlb maps them from the hugetlbfs pool
+ * (MAP_HUGETLB) instead, falling back to THP when the pool is empty. Off by
+ * default: huge pages trade memory (a touched byte commits 2 MiB) for fewer
+ * TLB misses.
+ */
+#define HUGE_PAGE ((size_t) 2 * 1024 * 1024)
+
+/**
+ * size_t huge_round(size_t size)
+ *
+ * Rounds a mapping size up to whole huge pages.
+ *
+ * @param size        mapping size
+ * @return size_t     rounded size
+  */
+static size_t huge_round(size_t size)
+{
+    return (size + HUGE_PAGE - 1) & ~(HUGE_PAGE - 1);
+}
+
+/**
+ * void *map_huge(size_t size, unsigned char *huge)
+ *
+ * Maps memory backed by huge pages as configured by g_config.hugepage.
+ *
+ * @param size        mapping size, a multiple of HUGE_PAGE
+ * @param huge        receives the HUGE_* mode the mapping got
+ * @return void       HUGE_PAGE aligned mapping, or NULL
+  */
+static void *map_huge(size_t size, unsigned char *huge)
+{
+    if (g_config.hugepage == HUGE_TLB) {
+        void *mem = mmap(NULL, size, PROT_READ | PROT_WRITE,
+                MAP_PRIVATE | MAP_ANONYMOUS | MAP_HUGETLB, -1, 0);
+        if (mem != MAP_FAILED) {
+            stats_map(size);
+            *huge = HUGE_TLB;
+            return mem;
+        }
+        LOG("MAP_HUGETLB failed, using transparent huge pages%s", "\n");
+    }
+    void *mem = map_aligned(size, HUGE_PAGE);
+    if (mem == NULL) {
+        return NULL;
+    }
+    if (madvise(mem, size, MADV_HUGEPAGE) != 0) {
+        LOG("MADV_HUGEPAGE failed @ %p\n", mem);
+    }
+    *huge = HUGE_THP;
+    return mem;
+}
+
+/**
+ * size_t huge_backed(void)
+ *
+ * Reads how much of the process' anonymous memory the kernel currently backs
+ * with transparent huge pages. Uses plain system calls, so that it does not
+ * allocate.
+ *
+ * @return size_t     bytes, 0 if unknown
+  */
+static size_t huge_backed(void)
+{
+    char buffer[4096];
+    int fd = open("/proc/self/smaps_rollup", O_RDONLY);
+    if (fd < 0) {
+        return 0;
+    }
+    ssize_t length = read(fd, buffer, sizeof(buffer) - 1);
+    close(fd);
+    if (length <= 0) {
+        return 0;
+    }
+    buffer[length] = '\0';
+    char *line = strstr(buffer, "AnonHugePages:");
+    if (line == NULL) {
+        return 0;
+    }
+    return strtoull(line + strlen("AnonHugePages:"), NULL, 10) * 1024;
+}
+
+/* -- Purging -- */
+
+/**
+ * Free memory is handed back to the kernel lazily. Releasing a block only
+ * marks its arena dirty; once an arena has stayed dirty for
+ * ALLOCATOR_DECAY_MS milliseconds (default DECAY_MS), a purge pass runs
+ * madvise() over every whole page of free space in it: free blocks, unused
+ * block tails, span holes and space given back to a span's bump pointer.
+ * Large regions cached for longer than that are unmapped. The pass is
+ * triggered every PURGE_TICKS releases in the arena, or, with
+ * ALLOCATOR_PURGE_THREAD=1, by a background thread, which keeps it off the
+ * free() path entirely. On the free() path a check visits at most
+ * PURGE_BLOCKS blocks and PURGE_BATCH span holes; the next check resumes
+ * the pass where it stopped. ALLOCATOR_PURGE selects the advice: dontneed (the
+ * default, pages are dropped at once and RSS goes down), free (MADV_FREE,
+ * dropped only under memory pressure but cheaper to reuse) or off.
+ */
+#define PURGE_TICKS 1024
+#define PURGE_BATCH 64 /*!< Holes purged per hold of the span lock */
+#define PURGE_BLOCKS 1024 /*!< Blocks a check on the free() path visits */
+static bool g_purge_background = false; /*!< Purging is done by purge_thread */
+static int g_purge_thread_started = 0; /*!< Set once purge_thread is created */
+
+/**
+ * unsigned long now_ms(void)
+ *
+ * Reads a cheap monotonic clock.
+ *
+ * @return unsigned long   milliseconds
+  */
+static unsigned long now_ms(void)
+{
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC_COARSE, &now);
+    return now.tv_sec * 1000UL + now.tv_nsec / 1000000 + 1;
+}
+
+/**
+ * bool decay_due(bool *dirty, unsigned long *since, unsigned long now)
+ *
+ * Tells whether something marked dirty has stayed so for the decay time.
+ * The first check after it got dirty starts the clock.
+ *
+ * @param dirty       dirty flag
+ * @param since       when the flag was first seen set, 0 if not yet
+ * @param now         current time in ms
+ * @return bool       true if a purge is due
+  */
+static bool decay_due(bool *dirty, unsigned long *since, unsigned long now)
+{
+    if (!*dirty) {
+        return false;
+    }
+    if (*since == 0) {
+        *since = now;
+    }
+    return now - *since >= g_config.decay_ms;
+}
+
+/**
+ * size_t purge_range(void *start, void *end)
+ *
+ * Hands the whole pages between two addresses back to the kernel.
+ *
+ * @param start       first free byte
+ * @param end         end of the free space
+ * @return size_t     bytes purged
+  */
+static size_t purge_range(void *start, void *end)
+{
+    uintptr_t page_size = getpagesize();
+    uintptr_t first = ((uintptr_t) start + page_size - 1) & ~(page_size - 1);
+    uintptr_t last = (uintptr_t) end & ~(page_size - 1);
+    if (first >= last || madvise((void *) first, last - first, g_config.purge) != 0) {
+        return 0;
+    }
+    return last - first;
+}
+
+/* -- Spans -- */
+
+/**
+ * Regions are carved out of spans: large mappings reserved up front, of
+ * ALLOCATOR_SPAN_MIN bytes at first and doubling with every new span up to
+ * ALLOCATOR_SPAN_MAX (defaults SPAN_MIN and SPAN_MAX; ALLOCATOR_SPAN_MAX=0
+ * maps every region on its own). A span hands out its space in units of
+ * span_grain() with a bump pointer; released regions become holes, marked in
+ * the span's free map, that later regions are carved from first (first fit).
+ * Holes merge implicitly, and a hole reaching the bump pointer moves it down.
+ * A second map marks the holes not purged yet. A span is unmapped once
+ * nothing in it is used, unless it is the newest one (by the purge pass when
+ * purging is on). Regions larger than a quarter of SPAN_MAX and large regions
+ * are mapped directly. With the compact header spans are REGION_ALIGN aligned
+ * and carved in REGION_ALIGN units, so every region stays aligned. With huge
+ * pages on, spans are whole huge pages.
+ */
+struct span {
+    struct span *next;          /*!< Next span, newest first */
+    struct span *prev;          /*!< Previous span */
+    void *base;                 /*!< Start of the mapping */
+    size_t size;                /*!< Size of the mapping */
+    size_t top;                 /*!< Bytes handed out by the bump pointer */
+    size_t high;                /*!< Highest top since the span was last purged */
+    size_t fresh;               /*!< Highest top ever; untouched beyond it */
+    size_t used;                /*!< Bytes held by regions */
+    uint64_t *free_map;         /*!< One bit per unit below top: in a hole */
+    uint64_t *dirty_map;        /*!< One bit per unit: in a hole, not purged */
+    size_t map_size;            /*!< Bytes mapped for both maps */
+    bool dirty;                 /*!< Space was released since the last purge */
+    unsigned char huge;         /*!< HUGE_* mode backing the span */
+};
+
+static pthread_mutex_t g_span_lock = PTHREAD_MUTEX_INITIALIZER; /*!< Protects the spans */
+static struct span *g_spans = NULL; /*!< Spans, newest first */
+static struct span *g_free_spans = NULL; /*!< Recycled span descriptors */
+static size_t g_span_next = SPAN_MIN; /*!< Size of the next span */
+static bool g_spans_dirty = false; /*!< A span was released into since the last purge */
+static unsigned long g_spans_dirty_since = 0; /*!< When that was first seen, in ms */
+static bool g_spans_purging = false; /*!< A span pass ran out of budget and resumes */
+
+/**
+ * size_t span_grain(void)
+ *
+ * Granularity regions are carved from spans in.
+ *
+ * @return size_t     carve unit
+  */
+static size_t span_grain(void)
+{
+#if ALLOCATOR_COMPACT_HEADER
+    return REGION_ALIGN;
+#else
+    return getpagesize();
+#endif
+}
+
+/**
+ * void map_assign(uint64_t *map, size_t start, size_t count, bool value)
+ *
+ * Sets or clears a range of bits.
+ *
+ * @param map         bitmap
+ * @param start       first bit
+ * @param count       number of bits
+ * @param value       true to set, false to clear
+ * @return void
+  */
+static void map_assign(uint64_t *map, size_t start, size_t count, bool value)
+{
+    while (count != 0) {
+        size_t offset = start % 64;
+        size_t bits = 64 - offset < count ? 64 - offset : count;
+        uint64_t mask = (bits == 64 ? ~(uint64_t) 0 : ((uint64_t) 1 << bits) - 1) << offset;
+        if (value) {
+            map[start / 64] |= mask;
+        } else {
+            map[start / 64] &= ~mask;
+        }
+        start += bits;
+        count -= bits;
+    }
+}
+
+/**
+ * size_t map_next(uint64_t *map, size_t from, size_t limit, bool value)
+ *
+ * Finds the first bit at or after 'from' that has the given value.
+ *
+ * @param map         bitmap
+ * @param from        first bit to look at
+ * @param limit       end of the search
+ * @param value       value looked for
+ * @return size_t     bit index, or 'limit' if there is none
+  */
+static size_t map_next(uint64_t *map, size_t from, size_t limit, bool value)
+{
+    while (from < limit) {
+        uint64_t word = value ? map[from / 64] : ~map[from / 64];
+        word &= ~(uint64_t) 0 << (from % 64);
+        if (word != 0) {
+            size_t bit = from / 64 * 64 + __builtin_ctzll(word);
+            return bit < limit ? bit : limit;
+        }
+        from = (from / 64 + 1) * 64;
+    }
+    return limit;
+}
+
+/**
+ * struct span *span_create(size_t size)
+ *
+ * Maps a new span of at least 'size' bytes, the next size of the geometric
+ * series if that is larger, and makes it the newest span. Must be called with
+ * g_span_lock held.
+ *
+ * @param size        space needed
+ * @return span       new span, or NULL
+  */
+static struct span *span_create(size_t size)
+{
+    if (size < g_span_next) {
+        size = (g_span_next + span_grain() - 1) & ~(span_grain() - 1);
+    }
+    if (g_config.hugepage != HUGE_OFF) {
+        size = huge_round(size);
+    }
+    pthread_mutex_lock(&g_meta_lock);
+    struct span *span = g_free_spans;
+    if (span != NULL) {
+        g_free_spans = span->next;
+    } else {
+        span = meta_alloc(sizeof(struct span));
+    }
+    pthread_mutex_unlock(&g_meta_lock);
+    if (span == NULL) {
+        return NULL;
+    }
+    memset(span, 0, sizeof(struct span));
+    size_t words = (size / span_grain() + 63) / 64;
+    span->map_size = (2 * words * sizeof(uint64_t) + getpagesize() - 1) & ~(size_t) (getpagesize() - 1);
+    span->free_map = map_aligned(span->map_size, getpagesize());
+    if (span->free_map != NULL) {
+        span->dirty_map = span->free_map + words;
+        if (g_config.hugepage != HUGE_OFF) {
+            span->base = map_huge(size, &span->huge);
+        } else {
+            span->base = map_aligned(size, span_grain());
+        }
+        if (span->base == NULL) {
+            munmap(span->free_map, span->map_size);
+            stats_unmap(span->map_size);
+        }
+    }
+    if (span->free_map == NULL || span->base == NULL) {
+        pthread_mutex_lock(&g_meta_lock);
+        span->next = g_free_spans;
+        g_free_spans = span;
+        pthread_mutex_unlock(&g_meta_lock);
+        return NULL;
+    }
+    span->size = size;
+    span->next = g_spans;
+    if (g_spans != NULL) {
+        g_spans->prev = span;
+    }
+    g_spans = span;
+    if (g_span_next < g_config.span_max) {
+        g_span_next = g_span_next * 2 < g_config.span_max ? g_span_next * 2 : g_config.span_max;
+    }
+    LOG("Mapped span @ %p, %zu bytes\n", span->base, size);
+    return span;
+}
+
+/**
+ * void span_delete(struct span *span)
+ *
+ * Unlinks and unmaps a span nothing is carved from any more. Must be called
+ * with g_span_lock held.
+ *
+ * @param span        unused span
+ * @return void
+  */
+static void span_delete(struct span *span)
+{
+    if (span->prev != NULL) {
+        span->prev->next = span->next;
+    } else {
+        g_spans = span->next;
+    }
+    if (span->next != NULL) {
+        span->next->prev = span->prev;
+    }
+    munmap(span->base, span->size);
+    munmap(span->free_map, span->map_size);
+    stats_unmap(span->size);
+    stats_unmap(span->map_size);
+    pthread_mutex_lock(&g_meta_lock);
+    span->next = g_free_spans;
+    g_free_spans = span;
+    pthread_mutex_unlock(&g_meta_lock);
+}
+
+/**
+ * void *span_carve(size_t size, struct span **owner, bool *zero)
+ *
+ * Takes 'size' bytes for a region: from the first hole that fits, else from
+ * a span's bump pointer, else from a new span. The range is known to be zero
+ * if it was never handed out since the span was mapped or last purged, or if
+ * all of it was purged with MADV_DONTNEED.
+ *
+ * @param size        region size, a multiple of span_grain()
+ * @param owner       receives the span the region was carved from
+ * @param zero        receives whether the range is known to be zero
+ * @return void       start of the range, or NULL
+  */
+static void *span_carve(size_t size, struct span **owner, bool *zero)
+{
+    size_t grain = span_grain();
+    size_t units = size / grain;
+    void *mem = NULL;
+    *zero = false;
+    pthread_mutex_lock(&g_span_lock);
+    struct span *span;
+    for (span = g_spans; span != NULL; span = span->next) {
+        size_t limit = span->top / grain;
+        size_t start = map_next(span->free_map, 0, limit, true);
+        while (start < limit) {
+            size_t end = map_next(span->free_map, start, limit, false);
+            if (end - start >= units) {
+                *zero = g_config.purge == MADV_DONTNEED
+                    && map_next(span->dirty_map, start, start + units, true) == start + units;
+                map_assign(span->free_map, start, units, false);
+                map_assign(span->dirty_map, start, units, false);
+                mem = span->base + start * grain;
+                break;
+            }
+            start = map_next(span->free_map, end, limit, true);
+        }
+        if (mem == NULL && span->size - span->top >= size) {
+            mem = span->base + span->top;
+            /* only MADV_DONTNEED leaves purged pages reading as zero */
+            *zero = span->top >= (g_config.purge == MADV_DONTNEED ? span->high : span->fresh);
+            span->top += size;
+            if (span->top > span->fresh) {
+                span->fresh = span->top;
+            }
+            if (span->top > span->high) {
+                span->high = span->top;
+            }
+        }
+        if (mem != NULL) {
+            break;
+        }
+    }
+    if (mem == NULL) {
+        span = span_create(size);
+        if (span != NULL) {
+            mem = span->base;
+            span->top = size;
+            span->high = size;
+            span->fresh = size;
+            *zero = true;
+        }
+    }
+    if (span != NULL) {
+        span->used += size;
+        *owner = span;
+    }
+    pthread_mutex_unlock(&g_span_lock);
+    return mem;
+}
+
+/**
+ * void span_release(struct span *span, void *mem, size_t size)
+ *
+ * Gives a region's range back to its span: it becomes a hole, or moves the
+ * bump pointer down, together with the hole below it, if it ends there.
+ *
+ * @param span        span the range was carved from
+ * @param mem         start of the range
+ * @param size        size of the range
+ * @return void
+  */
+static void span_release(struct span *span, void *mem, size_t size)
+{
+    size_t grain = span_grain();
+    pthread_mutex_lock(&g_span_lock);
+    span->used -= size;
+    if (span->used == 0 && span != g_spans && g_config.purge == PURGE_OFF) {
+        span_delete(span);
+        pthread_mutex_unlock(&g_span_lock);
+        return;
+    }
+    span->dirty = true;
+    g_spans_dirty = true;
+    size_t start = (mem - span->base) / grain;
+    size_t limit = span->top / grain;
+    if (span->used == 0) {
+        start = 0;
+    } else if (mem + size != span->base + span->top) {
+        map_assign(span->free_map, start, size / grain, true);
+        map_assign(span->dirty_map, start, size / grain, true);
+        pthread_mutex_unlock(&g_span_lock);
+        return;
+    }
+    /* the range ends at the bump pointer: move it down over the hole below */
+    while (start > 0 && (span->free_map[(start - 1) / 64] >> ((start - 1) % 64) & 1)) {
+        start--;
+    }
+    map_assign(span->free_map, start, limit - start, false);
+    map_assign(span->dirty_map, start, limit - start, false);
+    span->top = start * grain;
+    pthread_mutex_unlock(&g_span_lock);
+}
+
+/**
+ * bool purge_spans(size_t budget)
+ *
+ * Purges the holes of the spans released into since the last pass, and the
+ * space above their bump pointer that was handed out before. Spans nothing
+ * is carved from any more are unmapped, except the newest one. Must be
+ * called with g_span_lock held.
+ *
+ * @param budget      most holes to purge before returning
+ * @return bool       true if the budget ran out before the pass was done
+  */
+static bool purge_spans(size_t budget)
+{
+    size_t grain = span_grain();
+    struct span *span = g_spans;
+    while (span != NULL) {
+        struct span *next = span->next;
+        if (span->used == 0 && span != g_spans) {
+            span_delete(span);
+            span = next;
+            continue;
+        }
+        if (!span->dirty) {
+            span = next;
+            continue;
+        }
+        if (span->huge == HUGE_TLB) {
+            /* hugetlb pages cannot be purged one by one; they stay dirty */
+            span->dirty = false;
+            span = next;
+            continue;
+        }
+        size_t limit = span->top / grain;
+        size_t start = map_next(span->dirty_map, 0, limit, true);
+        while (start < limit) {
+            if (budget-- == 0) {
+                return true;
+            }
+            size_t end = map_next(span->dirty_map, start, limit, false);
+            if (purge_range(span->base + start * grain, span->base + end * grain) == 0) {
+                break; /* left dirty, retried by the next pass */
+            }
+            map_assign(span->dirty_map, start, end - start, false);
+            start = map_next(span->dirty_map, end, limit, true);
+        }
+        if (purge_range(span->base + span->top, span->base + span->high) != 0) {
+            span->high = span->top;
+        }
+        span->dirty = false;
+        span = next;
+    }
+    return false;
+}
+
+/* -- Slabs -- */
+
+/**
+ * Requests up to SLAB_MAX_SIZE bytes are served from slabs: SLAB_SIZE-aligned
+ * chunks of one size class, carved from an address range reserved up front.
+ * Objects carry no header; a pointer belongs to a slab if it lies in the
+ * reserved range, and its slab is found by masking the address. Each slab
+ * keeps a free list threaded through its free objects and a bump pointer
+ * over the objects never handed out. Set ALLOCATOR_SLAB=0 to disable slabs.
+ */
+#define SLAB_SIZE ((size_t) 64 * 1024)
+#define SLAB_QUANTUM 16
+#define SLAB_MAX_SIZE 128
+#define SLAB_CLASSES (SLAB_MAX_SIZE / SLAB_QUANTUM)
+#define SLAB_RESERVE ((size_t) 16 * 1024 * 1024 * 1024)
+
+/** Slab header, at the start of the slab */
+struct slab {
+    struct slab *next;          /*!< Next slab with free objects, or next retired slab */
+    struct slab *prev;          /*!< Previous slab with free objects */
+    struct arena *arena;        /*!< Owning arena, NULL while retired */
+    void *free;                 /*!< Free list of released objects */
+    void *bump;                 /*!< First object never handed out */
+    size_t size;                /*!< Object size */
+    unsigned int used;          /*!< Objects handed out */
+    unsigned int capacity;      /*!< Objects the slab holds */
+};
+
+/** Offset of the first object, keeping objects 16-byte aligned */
+#define SLAB_HEADER ((sizeof(struct slab) + 15) & ~(size_t) 15)
+
+static pthread_mutex_t g_slab_lock = PTHREAD_MUTEX_INITIALIZER; /*!< Protects the reservation */
+static void *g_slab_base = NULL; /*!< Start of the reserved range */
+static size_t g_slab_span = 0; /*!< Size of the reserved range, 0 if slabs are off */
+static void *g_slab_top = NULL; /*!< First slab never used */
+static struct slab *g_slab_retired = NULL; /*!< Empty slabs, ready for any arena */
+
+/* -- Arenas -- */
+
+/**
+ * The heap is split into independent arenas, each with its own region list,
+ * lock and free space index. Threads are bound to arenas round-robin and move
+ * to the least loaded arena when their arena's lock keeps being contended.
+ * Every block records its arena, so free() always returns memory to its
+ * owner. ALLOCATOR_ARENAS sets the number of arenas (default: ARENAS_PER_CPU
+ * per online CPU, at most ARENA_MAX).
+ */
+#define ARENA_MAX 64
+#define ARENAS_PER_CPU 4
+#define ARENA_CONTENTION_LIMIT 8
+
+struct arena {
+    pthread_mutex_t lock;                /*!< Protects everything below */
+    struct region *regions;              /*!< Regions in mapping order */
+    struct region *last_region;          /*!< Tail of the region list */
+    struct free_extent *bins[BIN_COUNT]; /*!< Per size class free lists */
+    uint64_t bin_map[BIN_WORDS];         /*!< Bitmap of non-empty size classes */
+    struct slab *slabs[SLAB_CLASSES];    /*!< Per size class slabs with free objects */
+    struct free_extent *tree_root;       /*!< Size or address tree of extents, if used */
+    struct free_extent *tree_max;        /*!< Largest extent in the size tree */
+    struct free_extent *buddies[64];     /*!< Per order free buddy blocks */
+    uint64_t buddy_map;                  /*!< Bitmap of non-empty buddy orders */
+    struct mem_block *rover;             /*!< Where next_fit resumes, NULL for the start */
+    unsigned long fit_requests;          /*!< Searches made by next_fit */
+    unsigned long fit_visits;            /*!< Blocks visited by those searches */
+    size_t huge_bytes;                   /*!< Bytes of regions in huge page memory */
+    bool dirty;                          /*!< Blocks were released since the last purge */
+    unsigned long dirty_since;           /*!< When that was first seen, in ms */
+    unsigned int purge_ticks;            /*!< Releases since the last purge check */
+    struct mem_block *purge_next;        /*!< Where an unfinished purge pass resumes */
+    size_t purged;                       /*!< Bytes handed back by purge passes */
+    unsigned int threads;                /*!< Threads bound to this arena */
+    void *remote __attribute__((aligned(64))); /*!< Frees pushed while the lock was busy */
+} __attribute__((aligned(64)));
+
+static struct arena g_arenas[ARENA_MAX];
+static unsigned int g_arena_count = 0; /*!< Arenas in use, set up once */
+static unsigned int g_arena_next = 0; /*!< Round-robin binding cursor */
+static pthread_once_t g_arena_once = PTHREAD_ONCE_INIT;
+static pthread_key_t g_thread_key; /*!< Runs thread_exit when a thread exits */
+static __thread struct arena *t_arena __attribute__((tls_model("initial-exec")));
+static __thread unsigned int t_contention __attribute__((tls_model("initial-exec")));
+
+/**
+ * Requests of at least ALLOCATOR_LARGE_THRESHOLD bytes (default
+ * LARGE_THRESHOLD, 0 turns the path off) skip the fit search and get a
+ * region of their own, whose slack is never handed to other requests. When
+ * such a region is released its mapping is kept in a small cache shared by
+ * all arenas, bounded by LARGE_CACHE_SLOTS entries and ALLOCATOR_LARGE_CACHE
+ * bytes (default LARGE_CACHE_MAX), and handed to the next large request it
+ * fits without wasting more than half of it. Cached mappings keep their
+ * pages, so reusing one costs neither an mmap nor page faults.
+ */
+#define LARGE_CACHE_SLOTS 16
+
+static pthread_mutex_t g_large_lock = PTHREAD_MUTEX_INITIALIZER; /*!< Protects the cache */
+static struct region *g_large_cache[LARGE_CACHE_SLOTS]; /*!< Cached regions, oldest first */
+static unsigned int g_large_cached = 0; /*!< Entries in the cache */
+static size_t g_large_cached_bytes = 0; /*!< Bytes mapped by the cached regions */
+
+/**
+ * size_t block_size_for(size_t size)
+ *
+ * Computes the space a request occupies in a block: header plus data,
+ * rounded up to BLOCK_ALIGN bytes.
+ *
+ * @param size        memory size
+ * @return size_t     aligned block size
+  */
+static size_t block_size_for(size_t size)
+{
+    size_t actual_size = size + sizeof(struct mem_block);
+    if (actual_size % BLOCK_ALIGN != 0) {
+        actual_size = actual_size + (BLOCK_ALIGN - actual_size % BLOCK_ALIGN);
+    }
+    return actual_size;
+}
+
+/**
+ * bool size_too_large(size_t size)
+ *
+ * Tells whether the block size, region size or huge page rounding of a
+ * request would wrap around. No mapping could hold such a request anyway.
+ *
+ * @param size        memory size
+ * @return bool       true if the request must fail with ENOMEM
+  */
+static bool size_too_large(size_t size)
+{
+    return size > SIZE_MAX - sizeof(struct mem_block) - BLOCK_ALIGN - REGION_PROLOGUE
+            - getpagesize() - HUGE_PAGE;
+}
+
+/**
+ * int bin_index(size_t space)
+ *
+ * Maps an amount of free space to its size class.
+ *
+ * @param space       free space in bytes (at least MIN_EXTENT)
+ * @return int        size class
+  */
+static int bin_index(size_t space)
+{
+    int shift = 63 - __builtin_clzl(space);
+    int sub = (space >> (shift - BIN_SUBCLASS_BITS)) & (BIN_SUBCLASSES - 1);
+    return (shift - BIN_MIN_SHIFT) * BIN_SUBCLASSES + sub;
+}
+
+/**
+ * size_t bin_floor(int bin)
+ *
+ * Smallest amount of free space that falls into a size class.
+ *
+ * @param bin         size class
+ * @return size_t     lower bound of the class
+  */
+static size_t bin_floor(int bin)
+{
+    int shift = bin / BIN_SUBCLASSES + BIN_MIN_SHIFT;
+    size_t sub = bin % BIN_SUBCLASSES;
+    return ((size_t) 1 << shift) + (sub << (shift - BIN_SUBCLASS_BITS));
+}
+
+/**
+ * int bin_find(struct arena *arena, int from)
+ *
+ * Finds the first non-empty size class at or above 'from' using the bitmap.
+ *
+ * @param arena       arena to search
+ * @param from        first size class to consider
+ * @return int        size class, or -1 if all of them are empty
+  */
+static int bin_find(struct arena *arena, int from)
+{
+    for (int w = from / 64; w < BIN_WORDS; w++) {
+        uint64_t bits = arena->bin_map[w];
+        if (w == from / 64) {
+            bits &= ~0UL << (from % 64);
+        }
+        if (bits != 0) {
+            return w * 64 + __builtin_ctzl(bits);
+        }
+    }
+    return -1;
+}
+
+/**
+ * size_t free_space(struct mem_block *block)
+ *
+ * Free space held by a block: its unused tail, or all of it once freed.
+ *
+ * @param block       memory block
+ * @return size_t     free bytes
+  */
+static size_t free_space(struct mem_block *block)
+{
+    return block_size(block) - block->usage;
+}
+
+/**
+ * bool extent_indexed(struct mem_block *block)
+ *
+ * Tells whether a block's free space belongs in the index: it has to be able
+ * to hold another allocation, and a free block must have room for the
+ * free_extent after its header. With the compact header, a block split off
+ * the free space must also start within the region's first REGION_ALIGN
+ * bytes.
+ *
+ * @param block       memory block
+ * @return bool       true if the block's free space is indexed
+  */
+static bool extent_indexed(struct mem_block *block)
+{
+    if (free_space(block) < MIN_EXTENT) {
+        return false;
+    }
+#if ALLOCATOR_COMPACT_HEADER
+    /* a block split off here must stay maskable to its region */
+    if (((uintptr_t) block & (REGION_ALIGN - 1)) + block->usage >= REGION_ALIGN) {
+        return false;
+    }
+#endif
+    return block->usage != 0
+        || block_size(block) >= EXTENT_OFFSET + sizeof(struct free_extent);
+}
+
+/**
+ * struct free_extent *extent_of(struct mem_block *block)
+ *
+ * Locates the free_extent stored in a block's free space.
+ *
+ * @param block       memory block
+ * @return extent     index entry
+  */
+static struct free_extent *extent_of(struct mem_block *block)
+{
+    if (block->usage == 0) {
+        return (void *) block + EXTENT_OFFSET;
+    }
+    return (void *) block + block->usage;
+}
+
+/* Tree helpers; the color lives in bit 0 of parent_color (1 = red) */
+
+static inline struct free_extent *rb_parent(struct free_extent *extent)
+{
+    return (struct free_extent *) (extent->parent_color & ~(uintptr_t) 1);
+}
+
+static inline bool rb_red(struct free_extent *extent)
+{
+    return extent != NULL && (extent->parent_color & 1);
+}
+
+static inline void rb_set_parent(struct free_extent *extent, struct free_extent *parent)
+{
+    extent->parent_color = (uintptr_t) parent | (extent->parent_color & 1);
+}
+
+static inline void rb_set_red(struct free_extent *extent, bool red)
+{
+    extent->parent_color = (extent->parent_color & ~(uintptr_t) 1) | red;
+}
+
+/**
+ * bool tree_less(struct free_extent *a, struct free_extent *b)
+ *
+ * Size tree order: by free space, then by address so that ties go to the
+ * lowest block. Address tree order: by address.
+ *
+ * @param a           extent
+ * @param b           extent
+ * @return bool       true if a sorts before b
+  */
+static inline bool tree_less(struct free_extent *a, struct free_extent *b)
+{
+    if (g_config.index == INDEX_ADDRESS) {
+        return a->block < b->block;
+    }
+    return a->space < b->space || (a->space == b->space && a->block < b->block);
+}
+
+/**
+ * void tree_update(struct free_extent *node)
+ *
+ * Address tree: recomputes the largest free space in a node's subtree from
+ * its own free space and its children's.
+ *
+ * @param node        tree node
+ * @return void
+  */
+static inline void tree_update(struct free_extent *node)
+{
+    size_t max = free_space(node->block);
+    if (node->left != NULL && node->left->space > max) {
+        max = node->left->space;
+    }
+    if (node->right != NULL && node->right->space > max) {
+        max = node->right->space;
+    }
+    node->space = max;
+}
+
+/**
+ * void tree_replace(struct arena *arena, struct free_extent *old, struct free_extent *new)
+ *
+ * Puts 'new' (which may be NULL) where 'old' hangs from its parent.
+ *
+ * @param arena       arena owning the tree
+ * @param old         node being replaced
+ * @param new         replacement subtree
+ * @return void
+  */
+static void tree_replace(struct arena *arena, struct free_extent *old, struct free_extent *new)
+{
+    struct free_extent *parent = rb_parent(old);
+    if (parent == NULL) {
+        arena->tree_root = new;
+    } else if (parent->left == old) {
+        parent->left = new;
+    } else {
+        parent->right = new;
+    }
+    if (new != NULL) {
+        rb_set_parent(new, parent);
+    }
+}
+
+/**
+ * void tree_rotate(struct arena *arena, struct free_extent *node, bool left)
+ *
+ * Rotates the tree at 'node', to the left or to the right.
+ *
+ * @param arena       arena owning the tree
+ * @param node        node moving down
+ * @param left        true for a left rotation
+ * @return void
+  */
+static void tree_rotate(struct arena *arena, struct free_extent *node, bool left)
+{
+    struct free_extent *child = left ? node->right : node->left;
+    struct free_extent *inner = left ? child->left : child->right;
+    if (left) {
+        node->right = inner;
+        child->left = node;
+    } else {
+        node->left = inner;
+        child->right = node;
+    }
+    if (inner != NULL) {
+        rb_set_parent(inner, node);
+    }
+    tree_replace(arena, node, child);
+    rb_set_parent(node, child);
+    if (g_config.index == INDEX_ADDRESS) {
+        /* the subtree holds the same extents, now under 'child' */
+        child->space = node->space;
+        tree_update(node);
+    }
+}
+
+/**
+ * void tree_insert(struct arena *arena, struct free_extent *extent)
+ *
+ * Adds an extent, whose 'space' is its free space, to the tree.
+ *
+ * @param arena       arena owning the tree
+ * @param extent      new extent
+ * @return void
+  */
+static void tree_insert(struct arena *arena, struct free_extent *extent)
+{
+    struct free_extent *parent = NULL;
+    struct free_extent **link = &arena->tree_root;
+    bool by_address = g_config.index == INDEX_ADDRESS;
+    while (*link != NULL) {
+        parent = *link;
+        if (by_address && parent->space < extent->space) {
+            parent->space = extent->space;
+        }
+        link = tree_less(extent, parent) ? &parent->left : &parent->right;
+    }
+    extent->left = NULL;
+    extent->right = NULL;
+    extent->parent_color = (uintptr_t) parent | 1;
+    *link = extent;
+    if (!by_address && (arena->tree_max == NULL || tree_less(arena->tree_max, extent))) {
+        arena->tree_max = extent;
+    }
+
+    struct free_extent *node = extent;
+    while (rb_red(parent = rb_parent(node))) {
+        struct free_extent *grandparent = rb_parent(parent);
+        bool left = parent == grandparent->left;
+        struct free_extent *uncle = left ? grandparent->right : grandparent->left;
+        if (rb_red(uncle)) {
+            rb_set_red(parent, false);
+            rb_set_red(uncle, false);
+            rb_set_red(grandparent, true);
+            node = grandparent;
+            continue;
+        }
+        if (node == (left ? parent->right : parent->left)) {
+            tree_rotate(arena, parent, left);
+            node = parent;
+            parent = rb_parent(node);
+        }
+        rb_set_red(parent, false);
+        rb_set_red(grandparent, true);
+        tree_rotate(arena, grandparent, !left);
+    }
+    rb_set_red(arena->tree_root, false);
+}
+
+/**
+ * void tree_remove(struct arena *arena, struct free_extent *extent)
+ *
+ * Takes an extent out of the tree.
+ *
+ * @param arena       arena owning the tree
+ * @param extent      indexed extent
+ * @return void
+  */
+static void tree_remove(struct arena *arena, struct free_extent *extent)
+{
+    bool by_address = g_config.index == INDEX_ADDRESS;
+    if (!by_address && extent == arena->tree_max) {
+        /* the maximum has no right child: its predecessor is the largest node
+         * on its left, or else its parent */
+        struct free_extent *max = extent->left;
+        if (max == NULL) {
+            max = rb_parent(extent);
+        } else {
+            while (max->right != NULL) {
+                max = max->right;
+            }
+        }
+        arena->tree_max = max;
+    }
+
+    struct free_extent *child, *parent;
+    bool removed_red;
+    if (extent->left == NULL || extent->right == NULL) {
+        child = extent->left != NULL ? extent->left : extent->right;
+        parent = rb_parent(extent);
+        removed_red = rb_red(extent);
+        tree_replace(arena, extent, child);
+    } else {
+        /* swap in the successor, then fix up where it was taken from */
+        struct free_extent *next = extent->right;
+        while (next->left != NULL) {
+            next = next->left;
+        }
+        removed_red = rb_red(next);
+        child = next->right;
+        if (rb_parent(next) == extent) {
+            parent = next;
+        } else {
+            parent = rb_parent(next);
+            tree_replace(arena, next, child);
+            next->right = extent->right;
+            rb_set_parent(next->right, next);
+        }
+        tree_replace(arena, extent, next);
+        next->left = extent->left;
+        rb_set_parent(next->left, next);
+        rb_set_red(next, rb_red(extent));
+    }
+    if (by_address) {
+        /* every node whose subtree lost the extent is on the path up */
+        for (struct free_extent *node = parent; node != NULL; node = rb_parent(node)) {
+            tree_update(node);
+        }
+    }
+    if (removed_red) {
+        return;
+    }
+
+    while (child != arena->tree_root && !rb_red(child)) {
+        bool left = child == parent->left;
+        struct free_extent *sibling = left ? parent->right : parent->left;
+        if (rb_red(sibling)) {
+            rb_set_red(sibling, false);
+            rb_set_red(parent, true);
+            tree_rotate(arena, parent, left);
+            sibling = left ? parent->right : parent->left;
+        }
+        struct free_extent *near = left ? sibling->left : sibling->right;
+        struct free_extent *far = left ? sibling->right : sibling->left;
+        if (!rb_red(near) && !rb_red(far)) {
+            rb_set_red(sibling, true);
+            child = parent;
+            parent = rb_parent(child);
+            continue;
+        }
+        if (!rb_red(far)) {
+            rb_set_red(near, false);
+            rb_set_red(sibling, true);
+            tree_rotate(arena, sibling, !left);
+            sibling = left ? parent->right : parent->left;
+            far = left ? sibling->right : sibling->left;
+        }
+        rb_set_red(sibling, rb_red(parent));
+        rb_set_red(parent, false);
+        rb_set_red(far, false);
+        tree_rotate(arena, parent, left);
+        child = arena->tree_root;
+    }
+    if (child != NULL) {
+        rb_set_red(child, false);
+    }
+}
+
+/**
+ * struct free_extent *tree_lower_bound(struct arena *arena, size_t space)
+ *
+ * Finds the smallest extent holding at least 'space' bytes (the lowest one
+ * among equals).
+ *
+ * @param arena       arena owning the tree
+ * @param space       bytes needed
+ * @return extent     best fitting extent, or NULL
+  */
+static struct free_extent *tree_lower_bound(struct arena *arena, size_t space)
+{
+    struct free_extent *best = NULL;
+    struct free_extent *node = arena->tree_root;
+    while (node != NULL) {
+        if (node->space >= space) {
+            best = node;
+            node = node->left;
+        } else {
+            node = node->right;
+        }
+    }
+    return best;
+}
+
+/**
+ * struct free_extent *tree_first_fit(struct arena *arena, size_t space)
+ *
+ * Address tree: finds the lowest extent holding at least 'space' bytes, going
+ * left whenever the left subtree has room.
+ *
+ * @param arena       arena owning the tree
+ * @param space       bytes needed
+ * @return extent     first fitting extent, or NULL
+  */
+static struct free_extent *tree_first_fit(struct arena *arena, size_t space)
+{
+    struct free_extent *node = arena->tree_root;
+    if (node == NULL || node->space < space) {
+        return NULL;
+    }
+    while (true) {
+        if (node->left != NULL && node->left->space >= space) {
+            node = node->left;
+        } else if (free_space(node->block) >= space) {
+            return node;
+        } else {
+            node = node->right;
+        }
+    }
+}
+
+/**
+ * void index_insert(struct mem_block *block)
+ *
+ * Adds a block's free space to its arena's index, if it is worth indexing.
+ * Must be called with the arena locked, after the block's size/usage are
+ * final.
+ *
+ * @param block       memory block
+ * @return void
+  */
+static void index_insert(struct mem_block *block)
+{
+    if (!extent_indexed(block)) {
+        return;
+    }
+    struct arena *arena = block_region(block)->arena;
+    struct free_extent *extent = extent_of(block);
+    extent->block = block;
+    if (g_config.index != INDEX_BINS) {
+        extent->space = free_space(block);
+        tree_insert(arena, extent);
+        return;
+    }
+    int bin = bin_index(free_space(block));
+    extent->prev = NULL;
+    extent->next = arena->bins[bin];
+    if (extent->next != NULL) {
+        extent->next->prev = extent;
+    }
+    arena->bins[bin] = extent;
+    arena->bin_map[bin / 64] |= 1UL << (bin % 64);
+}
+
+/**
+ * void index_remove(struct mem_block *block)
+ *
+ * Removes a block's free space from its arena's index. Must be called with
+ * the arena locked, before the block's size/usage change.
+ *
+ * @param block       memory block
+ * @return void
+  */
+static void index_remove(struct mem_block *block)
+{
+    if (!extent_indexed(block)) {
+        return;
+    }
+    struct arena *arena = block_region(block)->arena;
+    struct free_extent *extent = extent_of(block);
+    if (g_config.index != INDEX_BINS) {
+        tree_remove(arena, extent);
+        return;
+    }
+    int bin = bin_index(free_space(block));
+    if (extent->prev != NULL) {
+        extent->prev->next = extent->next;
+    } else {
+        arena->bins[bin] = extent->next;
+        if (extent->next == NULL) {
+            arena->bin_map[bin / 64] &= ~(1UL << (bin % 64));
+        }
+    }
+    if (extent->next != NULL) {
+        extent->next->prev = extent->prev;
+    }
+}
+
+/**
+ * void *carve(struct mem_block *block, size_t actual_size)
+ *
+ * Places an allocation in the free space of a block. A free block is reused
+ * as is; otherwise a new block is split off the tail of the used part.
+ *
+ * @param block        block whose free space is used
+ * @param actual_size  aligned size including the header
+ * @return void        void pointer
+  */
+static void *carve(struct mem_block *block, size_t actual_size)
+{
+    struct region *region = block_region(block);
+    index_remove(block);
+    region->live++;
+    if (block->usage == 0) { /* consider available space as required space */
+        block_set_id(block);
+        block->usage = actual_size;
+        index_insert(block);
+        return block + 1;
+    }
+    /* if the space has some other usage, split a block off its tail */
+    struct mem_block *create_block = (void*) block + block->usage;
+    block_init(create_block, free_space(block), region);
+    block_set_id(create_block);
+    create_block->usage = actual_size;
+    create_block->prev = block;
+    create_block->next = block->next;
+    if (create_block->next != NULL) {
+        create_block->next->prev = create_block;
+    }
+    block->next = create_block;
+    block_set_size(block, block->usage);
+    index_insert(create_block);
+    return create_block + 1;
+}
+
+
+/**
+ * void join(struct mem_block *block, struct mem_block *next)
+ *
+ * Merges 'next' into the block physically before it: its space becomes part
+ * of the block's free tail. Neither block may be in the index. A next_fit
+ * rover or a purge pass resuming at 'next' moves to the surviving block.
+ *
+ * @param block       surviving block
+ * @param next        block->next, which must be free
+ * @return void
+  */
+static void join(struct mem_block *block, struct mem_block *next)
+{
+    struct arena *arena = block_region(block)->arena;
+    if (arena->rover == next) {
+        arena->rover = block;
+    }
+    if (arena->purge_next == next) {
+        arena->purge_next = block;
+    }
+    block_set_size(block, block_size(block) + block_size(next));
+    block->next = next->next;
+    if (block->next != NULL) {
+        block->next->prev = block;
+    }
+}
+
+/**
+ * struct mem_block *coalesce(struct mem_block *block)
+ *
+ * Immediate coalescing of a freed, unindexed block: a free successor is
+ * absorbed, then the block itself is merged into its predecessor, whose free
+ * tail it borders whether or not the predecessor is in use. Only the first
+ * block of a region ever stays behind as a free block.
+ *
+ * @param block       freed block
+ * @return block      block now holding the free space (not indexed)
+  */
+static struct mem_block *coalesce(struct mem_block *block)
+{
+    struct mem_block *next = block->next;
+    if (next != NULL && next->usage == 0) {
+        index_remove(next);
+        join(block, next);
+    }
+    struct mem_block *prev = block->prev;
+    if (prev != NULL) {
+        index_remove(prev);
+        join(prev, block);
+        block = prev;
+    }
+    return block;
+}
+
+/**
+ * bool arena_coalesce(struct arena *arena)
+ *
+ * Deferred coalescing: merges every free block of the arena into its
+ * predecessor in one sweep. Run when a fit search fails, before mapping a
+ * new region. Must be called with the arena locked.
+ *
+ * @param arena       arena to sweep
+ * @return bool       true if anything was merged
+  */
+static bool arena_coalesce(struct arena *arena)
+{
+    bool merged = false;
+    struct region *region = arena->regions;
+    while (region != NULL) {
+        if (!region_indexed(region)) { /* buddy blocks merge on free, large ones are alone */
+            region = region->next;
+            continue;
+        }
+        struct mem_block *block = region->start->next;
+        while (block != NULL) {
+            struct mem_block *next = block->next;
+            if (block->usage == 0) {
+                struct mem_block *prev = block->prev;
+                index_remove(block);
+                index_remove(prev);
+                join(prev, block);
+                index_insert(prev);
+                merged = true;
+            }
+            block = next;
+        }
+        region = region->next;
+    }
+    return merged;
+}
+
+/**
+ * void *region_map(size_t region_sz, bool large, struct span **owner, unsigned char *huge, bool *zero)
+ *
+ * Gets the memory for a region: carved from a span, or mapped on its own
+ * for large regions and regions too big for spans.
+ *
+ * @param region_sz   mapping size, a multiple of the page size
+ * @param large       the region will hold a single large block
+ * @param owner       receives the span, or NULL for a mapping of its own
+ * @param huge        receives the HUGE_* mode backing the memory
+ * @param zero        receives whether the memory is known to be zero
+ * @return void       region base, or NULL
+  */
+static void *region_map(size_t region_sz, bool large, struct span **owner,
+        unsigned char *huge, bool *zero)
+{
+    *owner = NULL;
+    *huge = HUGE_OFF;
+    *zero = true; /* fresh mappings are zero filled by the kernel */
+    if (!large && region_sz <= g_config.span_max / 4) {
+        size_t grain = span_grain();
+        void *mem = span_carve((region_sz + grain - 1) & ~(grain - 1), owner, zero);
+        if (mem != NULL) {
+            *huge = (*owner)->huge;
+        }
+        return mem;
+    }
+    if (g_config.hugepage != HUGE_OFF && region_sz >= HUGE_PAGE) {
+        if (region_sz % HUGE_PAGE == 0) {
+            return map_huge(region_sz, huge);
+        }
+        /* only the whole huge pages at the start can be backed */
+        void *mem = map_aligned(region_sz, HUGE_PAGE);
+        if (mem != NULL && madvise(mem, region_sz, MADV_HUGEPAGE) == 0) {
+            *huge = HUGE_THP;
+        }
+        return mem;
+    }
+#if ALLOCATOR_COMPACT_HEADER
+    return map_aligned(region_sz, REGION_ALIGN);
+#else
+    return map_aligned(region_sz, getpagesize());
+#endif
+}
+
+/**
+ * void region_unmap_memory(struct region *region)
+ *
+ * Gives a region's memory back to its span, or to the kernel, after taking
+ * it out of the page map.
+ *
+ * @param region      region whose blocks are all gone
+ * @return void
+  */
+static void region_unmap_memory(struct region *region)
+{
+    pagemap_set(region_base(region), region->size, NULL);
+    if (region->span != NULL) {
+        size_t grain = span_grain();
+        span_release(region->span, region_base(region), (region->size + grain - 1) & ~(grain - 1));
+    } else {
+        munmap(region_base(region), region->size);
+        stats_unmap(region->size);
+    }
+}
+
+/**
+ * void region_attach(struct arena *arena, struct region *region)
+ *
+ * Appends a region to an arena's list. Must be called with the arena locked.
+ *
+ * @param arena       new owner
+ * @param region      region on no list
+ * @return void
+  */
+static void region_attach(struct arena *arena, struct region *region)
+{
+    region->arena = arena;
+    if (region->huge != HUGE_OFF) {
+        arena->huge_bytes += region->size;
+    }
+    region->next = NULL;
+    region->prev = arena->last_region;
+    if (arena->last_region == NULL) {
+        arena->regions = region;
+    } else {
+        arena->last_region->next = region;
+    }
+    arena->last_region = region;
+}
+
+/**
+ * void region_detach(struct region *region)
+ *
+ * Drops an empty region's free space from the index and unlinks it from its
+ * arena. Must be called with the arena locked.
+ *
+ * @param region      region with no blocks in use
+ * @return void
+  */
+static void region_detach(struct region *region)
+{
+    struct arena *arena = region->arena;
+    if (region->huge != HUGE_OFF) {
+        arena->huge_bytes -= region->size;
+    }
+    if (arena->rover != NULL && block_region(arena->rover) == region) {
+        arena->rover = NULL; /* next_fit restarts at the first region */
+    }
+    if (arena->purge_next != NULL && block_region(arena->purge_next) == region) {
+        /* the purge pass goes on with the next region, or is over */
+        arena->purge_next = region->next != NULL ? region->next->start : NULL;
+    }
+    /* with immediate coalescing this is a single block; buddy regions get
+     * here fully merged, with the block on no free list */
+    if (region_indexed(region)) {
+        for (struct mem_block *block = region->start; block != NULL; block = block->next) {
+            index_remove(block);
+        }
+    }
+    if (region->prev != NULL) {
+        region->prev->next = region->next;
+    } else {
+        arena->regions = region->next;
+    }
+    if (region->next != NULL) {
+        region->next->prev = region->prev;
+    } else {
+        arena->last_region = region->prev;
+    }
+}
+
+/**
+ * void region_unmap(struct region *region)
+ *
+ * Detaches an empty region from its arena and unmaps it. Must be called
+ * with the arena locked.
+ *
+ * @param region      region with no blocks in use
+ * @return void
+  */
+static void region_unmap(struct region *region)
+{
+    region_detach(region);
+    region_unmap_memory(region);
+    region_delete(region);
+}
+
+static void thread_exit(void *arg);
+static void slab_reserve(void);
+
+/**
+ * void arena_setup(void)
+ *
+ * Loads the configuration, then sizes and initializes the arenas, once per
+ * process.
+ *
+ * @return void
+  */
+static void arena_setup(void)
+{
+    config_load();
+    scribble = g_config.scribble;
+    long count = g_config.arenas;
+    if (count == 0) {
+        count = sysconf(_SC_NPROCESSORS_ONLN) * ARENAS_PER_CPU;
+    }
+    if (count < 1) {
+        count = 1;
+    } else if (count > ARENA_MAX) {
+        count = ARENA_MAX;
+    }
+    for (int i = 0; i < count; i++) {
+        pthread_mutex_init(&g_arenas[i].lock, NULL);
+    }
+    g_span_next = g_config.span_min;
+    g_purge_background = g_config.purge != PURGE_OFF && g_config.purge_thread;
+    if (g_config.slab) {
+        slab_reserve();
+    }
+    pthread_key_create(&g_thread_key, thread_exit);
+    g_arena_count = count;
+}
+
+/**
+ * struct arena *thread_arena(void)
+ *
+ * Returns the arena the calling thread allocates from, binding the thread
+ * round-robin on first use.
+ *
+ * @return arena      the thread's arena
+  */
+static struct arena *thread_arena(void)
+{
+    if (t_arena == NULL) {
+        pthread_once(&g_arena_once, arena_setup);
+        unsigned int next = __atomic_fetch_add(&g_arena_next, 1, __ATOMIC_RELAXED);
+        t_arena = &g_arenas[next % g_arena_count];
+        __atomic_fetch_add(&t_arena->threads, 1, __ATOMIC_RELAXED);
+        pthread_setspecific(g_thread_key, t_arena);
+        stats_link();
+    }
+    return t_arena;
+}
+
+static void remote_drain(struct arena *arena);
+
+/**
+ * struct arena *arena_lock_thread(void)
+ *
+ * Locks the calling thread's arena and releases the frees other threads left
+ * on it. A thread that keeps finding its arena locked is moved to the arena
+ * with the fewest bound threads first.
+ *
+ * @return arena      the thread's arena, locked
+  */
+static struct arena *arena_lock_thread(void)
+{
+    struct arena *arena = thread_arena();
+    if (pthread_mutex_trylock(&arena->lock) == 0) {
+        t_contention = 0;
+        remote_drain(arena);
+        return arena;
+    }
+    if (++t_contention >= ARENA_CONTENTION_LIMIT) {
+        struct arena *least = arena;
+        for (unsigned int i = 0; i < g_arena_count; i++) {
+            if (g_arenas[i].threads < least->threads) {
+                least = &g_arenas[i];
+            }
+        }
+        if (least != arena) {
+            LOG("Moving thread from arena %td to %td\n", arena - g_arenas, least - g_arenas);
+            __atomic_fetch_sub(&arena->threads, 1, __ATOMIC_RELAXED);
+            __atomic_fetch_add(&least->threads, 1, __ATOMIC_RELAXED);
+            t_arena = least;
+            /* thread_exit() must release the arena the thread is bound to now */
+            pthread_setspecific(g_thread_key, least);
+            arena = least;
+        }
+        t_contention = 0;
+    }
+    pthread_mutex_lock(&arena->lock);
+    remote_drain(arena);
+    return arena;
+}
+
+/**
+ * void slab_reserve(void)
+ *
+ * Reserves the address range slabs are carved from. Only address space is
+ * taken; slabs are made accessible as they are first used. If the range
+ * cannot be reserved, slabs stay off.
+ *
+ * @return void
+  */
+static void slab_reserve(void)
+{
+    void *mem = mmap(NULL, SLAB_RESERVE + SLAB_SIZE, PROT_NONE,
+            MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE, -1, 0);
+    if (mem == MAP_FAILED) {
+        LOG("Slab reservation failed, slabs disabled%s", "\n");
+        return;
+    }
+    stats_map(0); /* slabs count as mapped once they are made accessible */
+    g_slab_base = (void *) (((uintptr_t) mem + SLAB_SIZE - 1) & ~(SLAB_SIZE - 1));
+    g_slab_top = g_slab_base;
+    g_slab_span = SLAB_RESERVE;
+}
+
+/**
+ * bool slab_owns(void *ptr)
+ *
+ * Tells whether a pointer was handed out by a slab.
+ *
+ * @param ptr         data pointer
+ * @return bool       true for slab objects
+  */
+static inline bool slab_owns(void *ptr)
+{
+    return (uintptr_t) ptr - (uintptr_t) g_slab_base < g_slab_span;
+}
+
+/**
+ * struct slab *slab_of(void *ptr)
+ *
+ * Finds the slab holding an object.
+ *
+ * @param ptr         slab object
+ * @return slab       slab header
+  */
+static inline struct slab *slab_of(void *ptr)
+{
+    return (struct slab *) ((uintptr_t) ptr & ~(SLAB_SIZE - 1));
+}
+
+/**
+ * struct slab *slab_new(struct arena *arena, int class)
+ *
+ * Gets an empty slab for a size class, recycling a retired one if possible.
+ * Must be called with the arena locked.
+ *
+ * @param arena       arena the slab will belong to
+ * @param class       size class
+ * @return slab       new slab, or NULL once the reservation is used up
+  */
+static struct slab *slab_new(struct arena *arena, int class)
+{
+    pthread_mutex_lock(&g_slab_lock);
+    struct slab *slab = g_slab_retired;
+    if (slab != NULL) {
+        g_slab_retired = slab->next;
+    } else if (g_slab_top < g_slab_base + g_slab_span) {
+        if (mprotect(g_slab_top, SLAB_SIZE, PROT_READ | PROT_WRITE) != 0) {
+            perror("mprotect error");
+            pthread_mutex_unlock(&g_slab_lock);
+            return NULL;
+        }
+        STATS_ADD(mapped, SLAB_SIZE);
+        slab = g_slab_top;
+        g_slab_top += SLAB_SIZE;
+    }
+    pthread_mutex_unlock(&g_slab_lock);
+    if (slab == NULL) {
+        return NULL;
+    }
+    slab->next = NULL;
+    slab->prev = NULL;
+    slab->arena = arena;
+    slab->free = NULL;
+    slab->bump = (void *) slab + SLAB_HEADER;
+    slab->size = (size_t) (class + 1) * SLAB_QUANTUM;
+    slab->used = 0;
+    slab->capacity = (SLAB_SIZE - SLAB_HEADER) / slab->size;
+    return slab;
+}
+
+/**
+ * void slab_unlink(struct slab *slab, int class)
+ *
+ * Takes a slab off its arena's list of slabs with free objects.
+ *
+ * @param slab        slab on the list
+ * @param class       its size class
+ * @return void
+  */
+static void slab_unlink(struct slab *slab, int class)
+{
+    if (slab->prev != NULL) {
+        slab->prev->next = slab->next;
+    } else {
+        slab->arena->slabs[class] = slab->next;
+    }
+    if (slab->next != NULL) {
+        slab->next->prev = slab->prev;
+    }
+    slab->next = NULL;
+    slab->prev = NULL;
+}
+
+/**
+ * void *slab_alloc_locked(struct arena *arena, size_t size)
+ *
+ * Hands out an object from one of the arena's slabs. Must be called with the
+ * arena locked.
+ *
+ * @param arena       the calling thread's arena
+ * @param size        memory size, at most SLAB_MAX_SIZE
+ * @return void       object, or NULL if no slab could be made
+  */
+static void *slab_alloc_locked(struct arena *arena, size_t size)
+{
+    int class = size == 0 ? 0 : (size - 1) / SLAB_QUANTUM;
+    struct slab *slab = arena->slabs[class];
+    if (slab == NULL) {
+        slab = slab_new(arena, class);
+        if (slab == NULL) {
+            return NULL;
+        }
+        arena->slabs[class] = slab;
+    }
+    void *ptr = slab->free;
+    if (ptr != NULL) {
+        memcpy(&slab->free, ptr, sizeof(void *));
+    } else {
+        ptr = slab->bump;
+        slab->bump += slab->size;
+    }
+    if (++slab->used == slab->capacity) {
+        slab_unlink(slab, class); /* full slabs are off the list until a free */
+    }
+    return ptr;
+}
+
+/**
+ * void slab_release(void *ptr)
+ *
+ * Returns an object to its slab. A slab that becomes empty is retired for
+ * reuse by any arena (its pages are given back to the kernel), unless it is
+ * the last slab of its class in the arena. Must be called with the slab's
+ * arena locked.
+ *
+ * @param ptr         slab object
+ * @return void
+  */
+static void slab_release(void *ptr)
+{
+    struct slab *slab = slab_of(ptr);
+    struct arena *arena = slab->arena;
+    int class = slab->size / SLAB_QUANTUM - 1;
+    memcpy(ptr, &slab->free, sizeof(void *));
+    slab->free = ptr;
+    if (slab->used-- == slab->capacity) {
+        slab->next = arena->slabs[class];
+        if (slab->next != NULL) {
+            slab->next->prev = slab;
+        }
+        arena->slabs[class] = slab;
+    }
+    if (slab->used == 0 && (arena->slabs[class] != slab || slab->next != NULL)) {
+        slab_unlink(slab, class);
+        slab->arena = NULL;
+        int page_size = getpagesize();
+        madvise((void *) slab + page_size, SLAB_SIZE - page_size, MADV_DONTNEED);
+        pthread_mutex_lock(&g_slab_lock);
+        slab->next = g_slab_retired;
+        g_slab_retired = slab;
+        pthread_mutex_unlock(&g_slab_lock);
+    }
+}
+
+/* -- Thread caches -- */
+
+/**
+ * Small blocks are cached per thread so that a malloc/free pair on one thread
+ * does not take any lock. Requests up to TCACHE_MAX_SIZE bytes are rounded
+ * to TCACHE_QUANTUM-byte classes; each class keeps at most TCACHE_COUNT cached
+ * blocks and is refilled from (or flushed to) the heap TCACHE_BATCH blocks at
+ * a time under a single lock. Cached blocks stay "in use" from the heap's
+ * point of view. Set ALLOCATOR_TCACHE=0 to disable the caches.
+ */
+#define TCACHE_QUANTUM 16
+#define TCACHE_MAX_SIZE 1024
+#define TCACHE_CLASSES (TCACHE_MAX_SIZE / TCACHE_QUANTUM)
+#define TCACHE_COUNT 16
+#define TCACHE_BATCH (TCACHE_COUNT / 2)
+
+enum tcache_state { TCACHE_UNINIT = 0, TCACHE_ENABLED, TCACHE_DISABLED };
+
+/** One cached size class: a singly linked stack threaded through the data */
+struct tcache_bin {
+    void *head;
+    unsigned int count;
+};
+
+struct tcache {
+    enum tcache_state state;
+    struct tcache_bin bins[TCACHE_CLASSES];
+};
+
+static __thread struct tcache g_tcache __attribute__((tls_model("initial-exec")));
+
+static void *reuse_locked(size_t size);
+static void *map_region(size_t size, bool *zero);
+static void release(struct mem_block *block);
+
+/**
+ * struct arena *owner_arena(void *ptr)
+ *
+ * Finds the arena a slab object or heap block belongs to.
+ *
+ * @param ptr         data pointer
+ * @return arena      owning arena
+  */
+static struct arena *owner_arena(void *ptr)
+{
+    if (slab_owns(ptr)) {
+        return slab_of(ptr)->arena;
+    }
+    return block_region((struct mem_block *) ptr - 1)->arena;
+}
+
+/**
+ * void release_ptr(void *ptr)
+ *
+ * Returns a slab object to its slab or a block to its region. Must be called
+ * with the owning arena locked.
+ *
+ * @param ptr         data pointer
+ * @return void
+  */
+static void release_ptr(void *ptr)
+{
+    if (slab_owns(ptr)) {
+        slab_release(ptr);
+    } else {
+        release((struct mem_block *) ptr - 1);
+    }
+}
+
+/**
+ * size_t stats_size(void *ptr)
+ *
+ * Size a slab object or heap block is counted with in the statistics: the
+ * object size, or the block's usage without the header. Unlike
+ * usable_size() it needs no look at the region.
+ *
+ * @param ptr         data pointer
+ * @return size_t     bytes
+  */
+static inline size_t stats_size(void *ptr)
+{
+    if (slab_owns(ptr)) {
+        return slab_of(ptr)->size;
+    }
+    return ((struct mem_block *) ptr - 1)->usage - sizeof(struct mem_block);
+}
+
+/**
+ * void *tcache_next(void *ptr)
+ *
+ * Reads the link stored in the first bytes of a cached block's data. The
+ * data area is not pointer aligned, hence the memcpy.
+ *
+ * @param ptr         cached data pointer
+ * @return void       next cached data pointer
+  */
+static void *tcache_next(void *ptr)
+{
+    void *next;
+    memcpy(&next, ptr, sizeof(next));
+    return next;
+}
+
+/**
+ * Frees that find the owning arena locked do not wait for it: the pointer is
+ * pushed onto the arena's remote list with a single compare-and-swap, the
+ * link stored in the first bytes of its data as in the thread caches. Any
+ * thread that next locks the arena, usually its owner about to allocate,
+ * takes the whole list with one exchange and releases it. Blocks too small
+ * to hold the link wait for the lock instead.
+ */
+
+/**
+ * bool remote_push(struct arena *arena, void *ptr)
+ *
+ * Leaves a data pointer on an arena's remote list.
+ *
+ * @param arena       owning arena
+ * @param ptr         data pointer
+ * @return bool       true if pushed, false if the block cannot hold the link
+  */
+static bool remote_push(struct arena *arena, void *ptr)
+{
+    if (!slab_owns(ptr)
+            && ((struct mem_block *) ptr - 1)->usage < sizeof(struct mem_block) + sizeof(void *)) {
+        return false;
+    }
+    void *head = __atomic_load_n(&arena->remote, __ATOMIC_RELAXED);
+    do {
+        memcpy(ptr, &head, sizeof(head));
+    } while (!__atomic_compare_exchange_n(&arena->remote, &head, ptr, true,
+                __ATOMIC_RELEASE, __ATOMIC_RELAXED));
+    return true;
+}
+
+/**
+ * void remote_drain(struct arena *arena)
+ *
+ * Releases everything on an arena's remote list. Must be called with the
+ * arena locked.
+ *
+ * @param arena       locked arena
+ * @return void
+  */
+static void remote_drain(struct arena *arena)
+{
+    if (__atomic_load_n(&arena->remote, __ATOMIC_RELAXED) == NULL) {
+        return;
+    }
+    void *ptr = __atomic_exchange_n(&arena->remote, NULL, __ATOMIC_ACQUIRE);
+    while (ptr != NULL) {
+        void *next = tcache_next(ptr);
+        release_ptr(ptr);
+        ptr = next;
+    }
+}
+
+/**
+ * void tcache_push(struct tcache_bin *bin, void *ptr)
+ *
+ * Pushes a data pointer onto a cache bin.
+ *
+ * @param bin         cache bin
+ * @param ptr         data pointer
+ * @return void
+  */
+static void tcache_push(struct tcache_bin *bin, void *ptr)
+{
+    memcpy(ptr, &bin->head, sizeof(bin->head));
+    bin->head = ptr;
+    bin->count++;
+}
+
+/**
+ * void tcache_flush(struct tcache_bin *bin, unsigned int keep)
+ *
+ * Returns cached blocks to the heap until 'keep' remain, taking each owning
+ * arena's lock once per run of blocks from that arena.
+ *
+ * @param bin         cache bin
+ * @param keep        number of blocks left in the bin
+ * @return void
+  */
+static void tcache_flush(struct tcache_bin *bin, unsigned int keep)
+{
+    struct arena *locked = NULL;
+    while (bin->count > keep) {
+        void *ptr = bin->head;
+        bin->head = tcache_next(ptr);
+        bin->count--;
+        struct arena *arena = owner_arena(ptr);
+        if (arena != locked) {
+            if (locked != NULL) {
+                pthread_mutex_unlock(&locked->lock);
+            }
+            locked = arena;
+            pthread_mutex_lock(&locked->lock);
+            remote_drain(locked);
+        }
+        release_ptr(ptr);
+    }
+    if (locked != NULL) {
+        pthread_mutex_unlock(&locked->lock);
+    }
+}
+
+/**
+ * void thread_exit(void *arg)
+ *
+ * Thread exit hook: hands every cached block back to the heap, unbinds
+ * the thread from its arena, retires its statistics shard and hands its
+ * log ring to the next thread.
+ *
+ * @param arg         the exiting thread's arena
+ * @return void
+  */
+static void thread_exit(void *arg)
+{
+    struct arena *arena = arg;
+    struct tcache *cache = &g_tcache;
+    if (cache->state == TCACHE_ENABLED) {
+        for (int i = 0; i < TCACHE_CLASSES; i++) {
+            tcache_flush(&cache->bins[i], 0);
+        }
+    }
+    cache->state = TCACHE_DISABLED;
+    __atomic_fetch_sub(&arena->threads, 1, __ATOMIC_RELAXED);
+    stats_retire();
+    logger_thread_exit();
+}
+
+/**
+ * struct tcache *tcache_get(void)
+ *
+ * Returns the calling thread's cache, setting it up on first use.
+ *
+ * @return tcache     the thread's cache, or NULL if caching is disabled
+  */
+static struct tcache *tcache_get(void)
+{
+    struct tcache *cache = &g_tcache;
+    if (cache->state == TCACHE_UNINIT) {
+        thread_arena(); /* loads the configuration, registers thread_exit */
+        cache->state = g_config.tcache ? TCACHE_ENABLED : TCACHE_DISABLED;
+    }
+    return cache->state == TCACHE_ENABLED ? cache : NULL;
+}
+
+/**
+ * void *tcache_alloc(size_t size)
+ *
+ * Serves a small request from the thread's cache, refilling the size class
+ * from the heap in one batch when it is empty.
+ *
+ * @param size        memory size
+ * @return void       data pointer, or NULL if the request is not cacheable
+  */
+static void *tcache_alloc(size_t size)
+{
+    if (size > TCACHE_MAX_SIZE) {
+        return NULL;
+    }
+    struct tcache *cache = tcache_get();
+    if (cache == NULL) {
+        return NULL;
+    }
+    int class = size == 0 ? 0 : (size - 1) / TCACHE_QUANTUM;
+    struct tcache_bin *bin = &cache->bins[class];
+    if (bin->head == NULL) {
+        size_t class_size = (size_t) (class + 1) * TCACHE_QUANTUM;
+        struct arena *arena = arena_lock_thread();
+        while (bin->count < TCACHE_BATCH) {
+            void *ptr = NULL;
+            if (class_size <= SLAB_MAX_SIZE && g_slab_span != 0) {
+                ptr = slab_alloc_locked(arena, class_size);
+            }
+            if (ptr == NULL) {
+                ptr = reuse_locked(class_size);
+            }
+            if (ptr == NULL) {
+                ptr = map_region(class_size, NULL);
+            }
+            if (ptr == NULL) {
+                break;
+            }
+            tcache_push(bin, ptr);
+        }
+        pthread_mutex_unlock(&arena->lock);
+        if (bin->head == NULL) {
+            return NULL;
+        }
+    }
+    void *ptr = bin->head;
+    bin->head = tcache_next(ptr);
+    bin->count--;
+    if (!slab_owns(ptr)) {
+        block_set_id((struct mem_block *) ptr - 1);
+    }
+    return ptr;
+}
+
+/**
+ * void *tcache_alloc_aligned(size_t size, size_t align)
+ *
+ * Serves an aligned request from the thread's cache if a block in its size
+ * class happens to be aligned, as blocks freed by a program that keeps
+ * asking for the same alignment are. The cache is not refilled.
+ *
+ * @param size        memory size
+ * @param align       alignment, a power of two
+ * @return void       data pointer, or NULL
+  */
+static void *tcache_alloc_aligned(size_t size, size_t align)
+{
+    if (size > TCACHE_MAX_SIZE) {
+        return NULL;
+    }
+    struct tcache *cache = tcache_get();
+    if (cache == NULL) {
+        return NULL;
+    }
+    struct tcache_bin *bin = &cache->bins[size == 0 ? 0 : (size - 1) / TCACHE_QUANTUM];
+    void *prev = NULL;
+    void *ptr = bin->head;
+    while (ptr != NULL && ((uintptr_t) ptr & (align - 1)) != 0) {
+        prev = ptr;
+        ptr = tcache_next(ptr);
+    }
+    if (ptr == NULL) {
+        return NULL;
+    }
+    void *next = tcache_next(ptr);
+    if (prev == NULL) {
+        bin->head = next;
+    } else {
+        memcpy(prev, &next, sizeof(next));
+    }
+    bin->count--;
+    if (!slab_owns(ptr)) {
+        block_set_id((struct mem_block *) ptr - 1);
+    }
+    return ptr;
+}
+
+/**
+ * int tcache_class(void *ptr)
+ *
+ * Finds the cache class of a slab object, or the largest class a block
+ * holds.
+ *
+ * @param ptr         data pointer
+ * @return int        class, or -1 if the pointer is not cacheable
+  */
+static int tcache_class(void *ptr)
+{
+    if (slab_owns(ptr)) {
+        return slab_of(ptr)->size / TCACHE_QUANTUM - 1;
+    }
+    struct mem_block *block = (struct mem_block *) ptr - 1;
+    if (block->usage < block_size_for(TCACHE_QUANTUM)) {
+        return -1;
+    }
+    size_t class = (block->usage - sizeof(struct mem_block)) / TCACHE_QUANTUM - 1;
+    return class < TCACHE_CLASSES ? (int) class : -1;
+}
+
+/**
+ * bool tcache_free(void *ptr, int class)
+ *
+ * Caches a slab object or a block big enough for one of the cache's classes
+ * on free, flushing half of the class to the heap when it is full.
+ *
+ * @param ptr         data pointer being freed
+ * @param class       cache class if the caller knows it (sized free), else -1
+ * @return bool       true if the pointer was cached
+  */
+static bool tcache_free(void *ptr, int class)
+{
+    if (class < 0) {
+        class = tcache_class(ptr);
+        if (class < 0) {
+            return false;
+        }
+    }
+    struct tcache *cache = tcache_get();
+    if (cache == NULL) {
+        return false;
+    }
+    struct tcache_bin *bin = &cache->bins[class];
+    if (bin->count >= TCACHE_COUNT) {
+        tcache_flush(bin, TCACHE_COUNT - TCACHE_BATCH);
+    }
+    tcache_push(bin, ptr);
+    return true;
+}
+
+/**
+ * size_t region_size_for(size_t bytes)
+ *
+ * Rounds the bytes needed after the region prologue up to whole pages.
+ *
+ * @param bytes       space needed for blocks
+ * @return size_t     mapping size
+  */
+static size_t region_size_for(size_t bytes)
+{
+    int page_size = getpagesize();
+    size_t num_pages = (bytes + REGION_PROLOGUE) / page_size;
+    if ((bytes + REGION_PROLOGUE) % page_size != 0) {
+        num_pages = num_pages + 1;
+    }
+    return num_pages * page_size;
+}
+
+/**
+ * struct mem_block *region_create(size_t region_sz, size_t block_sz, bool large, bool *zero)
+ *
+ * Maps a new region holding one free block and appends it to the calling
+ * thread's arena. The block is not indexed. Must be called with that arena
+ * locked.
+ *
+ * @param region_sz   mapping size, a multiple of the page size
+ * @param block_sz    size of the first block
+ * @param large       the region is dedicated to one large block
+ * @param zero        if not NULL, receives whether the block's data area is
+ *                    known to be zero
+ * @return block      the region's first block, or NULL
+  */
+static struct mem_block *region_create(size_t region_sz, size_t block_sz, bool large, bool *zero)
+{
+    struct span *span;
+    unsigned char huge;
+    bool zeroed;
+    void *base = region_map(region_sz, large, &span, &huge, &zeroed);
+    if (base == NULL) {
+        return NULL;
+    }
+    if (zero != NULL) {
+        *zero = zeroed;
+    }
+    struct region *region = region_new();
+    if (region != NULL && !pagemap_set(base, region_sz, region)) {
+        pagemap_set(base, region_sz, NULL);
+        region_delete(region);
+        region = NULL;
+    }
+    if (region == NULL) {
+        if (span != NULL) {
+            size_t grain = span_grain();
+            span_release(span, base, (region_sz + grain - 1) & ~(grain - 1));
+        } else {
+            munmap(base, region_sz);
+            stats_unmap(region_sz);
+        }
+        return NULL;
+    }
+    region->span = span;
+    region->large = large;
+    region->huge = huge;
+#if ALLOCATOR_COMPACT_HEADER
+    *(struct region **) base = region;
+#endif
+    struct mem_block *block = base + REGION_PROLOGUE;
+    region->start = block;
+    region->size = region_sz;
+    block_init(block, block_sz, region);
+    block->usage = 0;
+    block->prev = NULL;
+    block->next = NULL;
+    region_attach(thread_arena(), region);
+    return block;
+}
+
+/**
+ * void *map_region(size_t size, bool *zero)
+ *
+ * Maps a new region big enough for the request and appends it to the
+ * calling thread's arena. Must be called with that arena locked.
+ *
+ * @param size        memory size
+ * @param zero        if not NULL, receives whether the data is known to be zero
+ * @return void       data pointer of the region's first block, or NULL
+  */
+static void *map_region(size_t size, bool *zero)
+{
+    if (size_too_large(size)) {
+        errno = ENOMEM;
+        return NULL;
+    }
+    size_t actual_size = block_size_for(size);
+    LOG("Aligned size: %zu\n", actual_size);
+    /* calculate region_sz */
+    size_t region_sz = region_size_for(actual_size);
+#if ALLOCATOR_COMPACT_HEADER
+    /* small regions get a whole alignment unit; later requests fill it */
+    if (region_sz < REGION_ALIGN) {
+        region_sz = REGION_ALIGN;
+    }
+#endif
+    struct mem_block *block = region_create(region_sz, region_sz - REGION_PROLOGUE, false, zero);
+    if (block == NULL) {
+        return NULL;
+    }
+    block_region(block)->live = 1;
+    block_set_id(block);
+    block->usage = actual_size;
+    index_insert(block);
+    LOG("Successfully allocated memory @ %p\n", block);
+    return block + 1;
+}
+
+/**
+ * bool large_cache_put(struct region *region)
+ *
+ * Keeps a released large region for reuse, evicting the oldest cached
+ * regions to stay within the cache bounds.
+ *
+ * @param region      detached region with no block in use
+ * @return bool       false if the region is too large to be cached
+  */
+static bool large_cache_put(struct region *region)
+{
+    if (region->size > g_config.large_cache) {
+        return false;
+    }
+    pthread_mutex_lock(&g_large_lock);
+    while (g_large_cached == LARGE_CACHE_SLOTS
+            || g_large_cached_bytes + region->size > g_config.large_cache) {
+        struct region *oldest = g_large_cache[0];
+        g_large_cached--;
+        g_large_cached_bytes -= oldest->size;
+        memmove(&g_large_cache[0], &g_large_cache[1], g_large_cached * sizeof(struct region *));
+        pagemap_set(region_base(oldest), oldest->size, NULL);
+        munmap(region_base(oldest), oldest->size);
+        stats_unmap(oldest->size);
+        region_delete(oldest);
+    }
+    region->idle_since = now_ms();
+    g_large_cache[g_large_cached++] = region;
+    g_large_cached_bytes += region->size;
+    pthread_mutex_unlock(&g_large_lock);
+    return true;
+}
+
+/**
+ * struct region *large_cache_take(size_t region_sz)
+ *
+ * Takes the smallest cached region of at least region_sz bytes, as long as
+ * the request would use more than half of it.
+ *
+ * @param region_sz   mapping size needed
+ * @return region     detached region, or NULL if none fits
+  */
+static struct region *large_cache_take(size_t region_sz)
+{
+    pthread_mutex_lock(&g_large_lock);
+    int found = -1;
+    for (unsigned int i = 0; i < g_large_cached; i++) {
+        size_t cached_sz = g_large_cache[i]->size;
+        if (cached_sz >= region_sz && cached_sz / 2 < region_sz
+                && (found < 0 || cached_sz < g_large_cache[found]->size)) {
+            found = i;
+        }
+    }
+    struct region *region = NULL;
+    if (found >= 0) {
+        region = g_large_cache[found];
+        g_large_cached--;
+        g_large_cached_bytes -= region->size;
+        memmove(&g_large_cache[found], &g_large_cache[found + 1],
+                (g_large_cached - found) * sizeof(struct region *));
+    }
+    pthread_mutex_unlock(&g_large_lock);
+    return region;
+}
+
+/**
+ * void *large_alloc(size_t size, bool *zero)
+ *
+ * Gives a large request a region of its own, reusing a cached mapping when
+ * one fits. No fit search is made and the region's slack is not indexed.
+ *
+ * @param size        memory size
+ * @param zero        receives whether the data is known to be zero
+ * @return void       data pointer, or NULL with errno ENOMEM if nothing can
+ *                    be mapped
+  */
+static void *large_alloc(size_t size, bool *zero)
+{
+    if (size_too_large(size)) {
+        errno = ENOMEM;
+        return NULL;
+    }
+    size_t actual_size = block_size_for(size);
+    size_t region_sz = region_size_for(actual_size);
+    if (g_config.hugepage != HUGE_OFF && region_sz >= HUGE_PAGE) {
+        region_sz = huge_round(region_sz);
+    }
+    struct region *region = large_cache_take(region_sz);
+    struct arena *arena = arena_lock_thread();
+    struct mem_block *block;
+    if (region != NULL) {
+        block = region->start;
+        block_init(block, region->size - REGION_PROLOGUE, region);
+        block->prev = NULL;
+        block->next = NULL;
+        region_attach(arena, region);
+        *zero = false;
+        LOG("Reusing cached large region @ %p\n", block);
+    } else {
+        block = region_create(region_sz, region_sz - REGION_PROLOGUE, true, zero);
+        if (block == NULL) {
+            pthread_mutex_unlock(&arena->lock);
+            return NULL;
+        }
+        region = block_region(block);
+    }
+    region->live = 1;
+    block_set_id(block);
+    block->usage = actual_size;
+    pthread_mutex_unlock(&arena->lock);
+    LOG("Successfully allocated large block @ %p\n", block);
+    return block + 1;
+}
+
+/**
+ * void large_release(struct region *region)
+ *
+ * Detaches the region of a freed large block and caches its mapping, or
+ * unmaps it if it does not fit the cache. Must be called with the region's
+ * arena locked.
+ *
+ * @param region      large region
+ * @return void
+  */
+static void large_release(struct region *region)
+{
+    region->start->usage = 0;
+    region->live = 0;
+    region_detach(region);
+    if (!large_cache_put(region)) {
+        region_unmap_memory(region);
+        region_delete(region);
+    }
+}
+
+/**
+ * void purge_large_cache(unsigned long now)
+ *
+ * Unmaps the large regions that have been cached for the decay time.
+ *
+ * @param now         current time in ms
+ * @return void
+  */
+static void purge_large_cache(unsigned long now)
+{
+    pthread_mutex_lock(&g_large_lock);
+    unsigned int kept = 0;
+    for (unsigned int i = 0; i < g_large_cached; i++) {
+        struct region *region = g_large_cache[i];
+        if (now - region->idle_since >= g_config.decay_ms) {
+            g_large_cached_bytes -= region->size;
+            region_unmap_memory(region);
+            region_delete(region);
+        } else {
+            g_large_cache[kept++] = region;
+        }
+    }
+    g_large_cached = kept;
+    pthread_mutex_unlock(&g_large_lock);
+}
+
+/**
+ * bool purge_arena(struct arena *arena, size_t budget)
+ *
+ * Purges the whole pages of free space in an arena's blocks. The free_extent
+ * at the start of a block's free space is kept. A pass that runs out of
+ * budget records the next block in arena->purge_next and is resumed there.
+ * Must be called with the arena locked.
+ *
+ * @param arena       arena to purge
+ * @param budget      most blocks to visit before returning
+ * @return bool       true if the budget ran out before the pass was done
+  */
+static bool purge_arena(struct arena *arena, size_t budget)
+{
+    struct mem_block *block = arena->purge_next;
+    if (block == NULL) {
+        /* releases made during the pass mark the arena dirty again */
+        arena->dirty = false;
+        arena->dirty_since = 0;
+    }
+    struct region *region = block == NULL ? arena->regions : block_region(block);
+    for (; region != NULL; region = region->next, block = NULL) {
+        if (region->huge == HUGE_TLB) {
+            continue;
+        }
+        /* live buddy and large blocks own their slack, see usable_size() */
+        bool slack_free = region_indexed(region);
+        for (block = block == NULL ? region->start : block; block != NULL; block = block->next) {
+            if (budget-- == 0) {
+                arena->purge_next = block;
+                return true;
+            }
+            if (block->usage != 0 && !slack_free) {
+                continue;
+            }
+            void *start = block->usage == 0
+                ? (void *) block + EXTENT_OFFSET : (void *) block + block->usage;
+            arena->purged += purge_range(start + sizeof(struct free_extent),
+                    (void *) block + block_size(block));
+        }
+    }
+    arena->purge_next = NULL;
+    return false;
+}
+
+/**
+ * bool purge_shared(size_t budget)
+ *
+ * Runs the purge passes over the memory shared by all arenas that are due,
+ * or resumes an unfinished one: the spans' and the large cache's. At most
+ * 'budget' holes are purged, so releases are not held up by g_span_lock
+ * for the whole pass.
+ *
+ * @param budget      most holes to purge
+ * @return bool       true if the span pass is not done yet
+  */
+static bool purge_shared(size_t budget)
+{
+    unsigned long now = now_ms();
+    pthread_mutex_lock(&g_span_lock);
+    if (g_spans_purging || decay_due(&g_spans_dirty, &g_spans_dirty_since, now)) {
+        if (!g_spans_purging) {
+            /* releases made during the pass mark the spans dirty again */
+            g_spans_dirty = false;
+            g_spans_dirty_since = 0;
+        }
+        g_spans_purging = purge_spans(budget);
+    }
+    bool unfinished = g_spans_purging;
+    pthread_mutex_unlock(&g_span_lock);
+    if (!unfinished && g_large_cached != 0) {
+        purge_large_cache(now);
+    }
+    return unfinished;
+}
+
+/**
+ * void purge_check(struct arena *arena, size_t budget)
+ *
+ * Purges an arena's free pages if they are due, or goes on with an
+ * unfinished pass. Must be called with the arena locked.
+ *
+ * @param arena       arena to check
+ * @param budget      most blocks to visit
+ * @return void
+  */
+static void purge_check(struct arena *arena, size_t budget)
+{
+    if (arena->purge_next != NULL || decay_due(&arena->dirty, &arena->dirty_since, now_ms())) {
+        purge_arena(arena, budget);
+    }
+}
+
+/**
+ * void *purge_thread(void *arg)
+ *
+ * Background purger: checks every arena a few times per decay period.
+ *
+ * @param arg         unused
+ * @return void       never returns
+  */
+static void *purge_thread(void *arg)
+{
+    unsigned long interval = g_config.decay_ms / 4 < 10 ? 10 : g_config.decay_ms / 4;
+    struct timespec pause = { interval / 1000, interval % 1000 * 1000000 };
+    stats_link(); /* counts the spans it gives back */
+    for (;;) {
+        nanosleep(&pause, NULL);
+        for (unsigned int i = 0; i < g_arena_count; i++) {
+            pthread_mutex_lock(&g_arenas[i].lock);
+            remote_drain(&g_arenas[i]);
+            purge_check(&g_arenas[i], SIZE_MAX);
+            pthread_mutex_unlock(&g_arenas[i].lock);
+        }
+        while (purge_shared(PURGE_BATCH)) {
+            /* g_span_lock was dropped between the batches */
+        }
+    }
+    return NULL;
+}
+
+/**
+ * void purge_thread_start(void)
+ *
+ * Starts the background purger on the first free() that wants it. Called
+ * with no lock held, since creating a thread may allocate.
+ *
+ * @return void
+  */
+static void purge_thread_start(void)
+{
+    if (__atomic_exchange_n(&g_purge_thread_started, 1, __ATOMIC_ACQ_REL) != 0) {
+        return;
+    }
+    pthread_t thread;
+    pthread_attr_t attr;
+    pthread_attr_init(&attr);
+    pthread_attr_setdetachstate(&attr, PTHREAD_CREATE_DETACHED);
+    if (pthread_create(&thread, &attr, purge_thread, NULL) != 0) {
+        /* purge from the free() path after all */
+        g_purge_background = false;
+    }
+    pthread_attr_destroy(&attr);
+}
+
+/**
+ * void block_name(struct mem_block *block, char *name)
+ *
+ * Names a block just handed out; unnamed blocks are named after their
+ * allocation ID, except with the compact header, which has no room for one.
+ *
+ * @param block       memory block
+ * @param name        pointer to memory name, or NULL
+ * @return void
+  */
+static void block_name(struct mem_block *block, char *name)
+{
+#if ALLOCATOR_COMPACT_HEADER
+    if (name != NULL) {
+        name_set(block, name);
+    }
+#else
+    if(name == NULL){
+        char buffer[32];
+        sprintf(buffer, "%lu", block->alloc_id);
+        strcpy(block->name, AUTO_NAME);
+        strcat(block->name, buffer);
+    } else {
+        strcpy(block->name, name);
+    }
+    LOG("ALLOCATION ID: %lu\n", block->alloc_id);
+#endif
+}
+
+/**
+ * void *allocate(size_t size, char *name, bool *zeroed)
+ *
+ * Allocates dynamic memory for malloc_name() and calloc(). Memory that comes
+ * straight from a new mapping, the untouched part of a span or a hole purged
+ * with MADV_DONTNEED is known to read as zero, which calloc() uses to skip
+ * clearing it.
+ *
+ * @param size        memory size
+ * @param name        pointer to memory name, or NULL
+ * @param zeroed      if not NULL, receives whether the data is known to be zero
+ * @return void       data pointer, or NULL
+  */
+static void *allocate(size_t size, char *name, bool *zeroed)
+{
+    LOG("Allocation Requestion: %zu bytes\n", size);
+    /* before block_size_for(), which would wrap around */
+    if (size_too_large(size)) {
+        errno = ENOMEM;
+        return NULL;
+    }
+    void *region_ptr = NULL;
+    bool zero = false;
+    thread_arena(); /* loads the configuration on first use */
+    if (size >= g_config.large_threshold) {
+        region_ptr = large_alloc(size, &zero);
+    }
+    /* named requests need a header for the name and should show up in
+     * print_memory() where they were placed, so they skip the caches */
+    if (region_ptr == NULL && name == NULL) {
+        region_ptr = tcache_alloc(size);
+    }
+    if (region_ptr == NULL && name == NULL && size <= SLAB_MAX_SIZE && g_slab_span != 0) {
+        struct arena *arena = arena_lock_thread();
+        region_ptr = slab_alloc_locked(arena, size);
+        pthread_mutex_unlock(&arena->lock);
+    }
+    if (region_ptr == NULL) {
+        region_ptr = reuse(size);
+    }
+    if (region_ptr == NULL) {
+        LOG("Region pointer was %s", "NULL\n");
+        struct arena *arena = arena_lock_thread();
+        region_ptr = map_region(size, &zero);
+        pthread_mutex_unlock(&arena->lock);
+        if (region_ptr == NULL) {
+            return NULL;
+        }
+    }
+    stats_alloc(stats_size(region_ptr));
+    if (g_config.scribble) {
+        memset(region_ptr, 0xAA, size);
+        zero = false;
+    }
+    if (zeroed != NULL) {
+        *zeroed = zero;
+    }
+    if (slab_owns(region_ptr)) {
+        LOG("Successfully return slab object @ %p\n", region_ptr);
+        return region_ptr;
+    }
+    /* the block belongs to the caller now, so naming it needs no lock */
+    block_name((struct mem_block*) region_ptr - 1, name);
+    LOG("Successfully return region_ptr @ %p\n", region_ptr);
+    return region_ptr;
+}
+
+/**
+ * void *malloc_name(size_t size, char *name)
+ *
+ * Malloc name to allocate dynamic memory and provide name feature
+ *
+ * @param size        memory size
+ * @param name        pointer to memory name
+ * @return void
+  */
+void *malloc_name(size_t size, char *name){
+    return allocate(size, name, NULL);
+}
+
+/**
+ * struct mem_block *index_first(struct arena *arena, size_t space)
+ *
+ * Finds the first indexed block with at least 'space' bytes free: the lowest
+ * one in the address tree, the best fit in the size tree, or with size
+ * classes the first extent of the smallest class guaranteed to hold it, else
+ * the first fit in its own class.
+ *
+ * @param arena       arena to search
+ * @param space       free space needed
+ * @return block      block holding the space, or NULL
+  */
+static struct mem_block *index_first(struct arena *arena, size_t space)
+{
+    if (g_config.index == INDEX_ADDRESS) {
+        struct free_extent *extent = tree_first_fit(arena, space);
+        return extent == NULL ? NULL : extent->block;
+    }
+    if (g_config.index == INDEX_SIZE) {
+        struct free_extent *extent = tree_lower_bound(arena, space);
+        return extent == NULL ? NULL : extent->block;
+    }
+    int bin = bin_index(space);
+    int fit_bin = bin_floor(bin) < space ? bin + 1 : bin;
+    int found = bin_find(arena, fit_bin);
+    if (found >= 0) {
+        return arena->bins[found]->block;
+    }
+    if (fit_bin != bin) { /* the request's own class may still hold a fit */
+        struct free_extent *extent = arena->bins[bin];
+        while (extent != NULL) {
+            STATS_ADD(fit_visits, 1);
+            if (free_space(extent->block) >= space) {  /* find the first space */
+                return extent->block;
+            }
+            extent = extent->next;
+        }
+    }
+    return NULL;
+}
+
+/**
+ * void *first_fit(size_t size)
+ *
+ * A part of FSM system to find first fit memory: the lowest-address block
+ * with enough free space, found in O(log n) by the address tree.
+ *
+ * @param size        memory size
+ * @return void       void pointer
+  */
+void *first_fit(size_t size)
+{
+    /* first fit FSM implementation */
+    size_t actual_size = block_size_for(size); /* calculate actual size = size + header */
+    struct mem_block *block = index_first(thread_arena(), actual_size);
+    return block == NULL ? NULL : carve(block, actual_size);
+}
+
+/**
+ * void *worst_fit(size_t size)
+ *
+ * A part of FSM system to find worst fit memory. The size tree keeps its
+ * maximum at hand.
+ *
+ * @param size        memory size
+ * @return void       void pointer
+  */
+void *worst_fit(size_t size)
+{
+    /* worst fit FSM implementation */
+    struct arena *arena = thread_arena();
+    size_t actual_size = block_size_for(size);
+    struct free_extent *max = arena->tree_max;
+    if (max == NULL || max->space < actual_size) {
+        return NULL;
+    }
+    return carve(max->block, actual_size);
+}
+
+/**
+ * void *best_fit(size_t size)
+ *
+ * A part of FSM system to find best fit memory: a lower bound search in the
+ * size tree.
+ *
+ * @param size        memory size
+ * @return void       void pointer
+  */
+void *best_fit(size_t size)
+{
+    /*best fit FSM implementation */
+    struct arena *arena = thread_arena();
+    size_t actual_size = block_size_for(size);
+    struct free_extent *extent = tree_lower_bound(arena, actual_size);
+    if (extent == NULL) {
+        return NULL;
+    }
+    LOG("best was: %zu\n", extent->space - actual_size);
+    return carve(extent->block, actual_size);
+}
+
+/**
+ * Set at build time (-DNEXT_FIT_RESTART) to start every next_fit search at the
+ * arena's first region, as a list-walking first fit does; used to measure
+ * what the rover saves (see test/next_fit_breakdown.txt).
+ */
+#ifndef NEXT_FIT_RESTART
+#define NEXT_FIT_RESTART 0
+#endif
+
+/**
+ * struct mem_block *next_block(struct arena *arena, struct mem_block *block)
+ *
+ * Steps through an arena's blocks in address order within each region and in
+ * mapping order across regions, wrapping around at the end. Buddy and
+ * large regions are skipped.
+ *
+ * @param arena       arena being walked
+ * @param block       current block, or NULL to start at the first region
+ * @return block      following block, or NULL if the arena has none
+  */
+static struct mem_block *next_block(struct arena *arena, struct mem_block *block)
+{
+    struct region *region = arena->regions;
+    if (block != NULL) {
+        if (block->next != NULL) {
+            return block->next;
+        }
+        region = block_region(block)->next;
+    }
+    for (int pass = 0; pass < 2; pass++) {
+        for (; region != NULL; region = region->next) {
+            if (region_indexed(region)) {
+                return region->start;
+            }
+        }
+        region = arena->regions;
+    }
+    return NULL;
+}
+
+/**
+ * void *next_fit(size_t size)
+ *
+ * A part of FSM system to find next fit memory: walks the arena's blocks
+ * from where the previous search succeeded (the rover), so the long-lived,
+ * densely used start of the heap is not scanned again on every request.
+ *
+ * @param size        memory size
+ * @return void       void pointer
+  */
+void *next_fit(size_t size)
+{
+    struct arena *arena = thread_arena();
+    size_t actual_size = block_size_for(size);
+    struct mem_block *start = NEXT_FIT_RESTART ? NULL : arena->rover;
+    if (start == NULL) {
+        start = next_block(arena, NULL);
+        if (start == NULL) {
+            return NULL;
+        }
+    }
+    arena->fit_requests++;
+    struct mem_block *block = start;
+    do {
+        arena->fit_visits++;
+        STATS_ADD(fit_visits, 1);
+        if (free_space(block) >= actual_size && extent_indexed(block)) {
+            void *ptr = carve(block, actual_size);
+            arena->rover = (struct mem_block *) ptr - 1;
+            return ptr;
+        }
+        block = next_block(arena, block);
+    } while (block != start);
+    return NULL;
+}
+
+/* -- Buddy system -- */
+
+/**
+ * ALLOCATOR_ALGORITHM=buddy manages regions as power-of-two buddy trees of
+ * BUDDY_REGION_ORDER (larger requests get a tree of their own). A request is
+ * rounded up to a power of two and served from the smallest free block of at
+ * least that order, splitting it in halves; a block's buddy is found by
+ * XOR-ing its offset in the tree with its size, and freed blocks merge with
+ * their free buddies right away. Free blocks are listed per order, with a
+ * bitmap of the non-empty orders.
+ */
+#if ALLOCATOR_COMPACT_HEADER
+#define BUDDY_REGION_ORDER 15 /* the tree must stay in the maskable first REGION_ALIGN bytes */
+#else
+#define BUDDY_REGION_ORDER 20
+#endif
+
+/**
+ * int buddy_order(size_t size)
+ *
+ * Order of the smallest buddy block holding 'size' bytes; a free block must
+ * also have room for the list links of its free_extent.
+ *
+ * @param size        aligned size including the header
+ * @return int        block order
+  */
+static int buddy_order(size_t size)
+{
+    size_t min = EXTENT_OFFSET + offsetof(struct free_extent, parent_color);
+    if (size < min) {
+        size = min;
+    }
+    return 64 - __builtin_clzl(size - 1);
+}
+
+/**
+ * void buddy_push(struct arena *arena, struct mem_block *block, int order)
+ *
+ * Lists a free buddy block. Must be called with the arena locked.
+ *
+ * @param arena       owning arena
+ * @param block       free block
+ * @param order       its order
+ * @return void
+  */
+static void buddy_push(struct arena *arena, struct mem_block *block, int order)
+{
+    struct free_extent *extent = extent_of(block);
+    extent->block = block;
+    extent->prev = NULL;
+    extent->next = arena->buddies[order];
+    if (extent->next != NULL) {
+        extent->next->prev = extent;
+    }
+    arena->buddies[order] = extent;
+    arena->buddy_map |= 1UL << order;
+}
+
+/**
+ * void buddy_unlink(struct arena *arena, struct mem_block *block, int order)
+ *
+ * Takes a free buddy block off its list. Must be called with the arena
+ * locked.
+ *
+ * @param arena       owning arena
+ * @param block       listed free block
+ * @param order       its order
+ * @return void
+  */
+static void buddy_unlink(struct arena *arena, struct mem_block *block, int order)
+{
+    struct free_extent *extent = extent_of(block);
+    if (extent->prev != NULL) {
+        extent->prev->next = extent->next;
+    } else {
+        arena->buddies[order] = extent->next;
+        if (extent->next == NULL) {
+            arena->buddy_map &= ~(1UL << order);
+        }
+    }
+    if (extent->next != NULL) {
+        extent->next->prev = extent->prev;
+    }
+}
+
+/**
+ * void *buddy_fit(size_t size)
+ *
+ * Buddy allocation: splits the smallest free block of a sufficient order,
+ * mapping a new tree when there is none.
+ *
+ * @param size        memory size
+ * @return void       void pointer, or NULL if no tree could be mapped
+  */
+void *buddy_fit(size_t size)
+{
+    struct arena *arena = thread_arena();
+    size_t actual_size = block_size_for(size);
+    int order = buddy_order(actual_size);
+    if (order > 62) {
+        return NULL;
+    }
+    uint64_t orders = arena->buddy_map & (~0UL << order);
+    struct mem_block *block;
+    int k;
+    if (orders != 0) {
+        k = __builtin_ctzl(orders);
+        block = arena->buddies[k]->block;
+        buddy_unlink(arena, block, k);
+    } else {
+        k = order > BUDDY_REGION_ORDER ? order : BUDDY_REGION_ORDER;
+        size_t tree = (size_t) 1 << k;
+        block = region_create(region_size_for(tree), tree, false, NULL);
+        if (block == NULL) {
+            return NULL;
+        }
+        block_region(block)->order = k;
+    }
+    struct region *region = block_region(block);
+    while (k > order) { /* split, keeping the lower half */
+        k--;
+        struct mem_block *half = (void *) block + ((size_t) 1 << k);
+        block_init(half, (size_t) 1 << k, region);
+        half->usage = 0;
+        half->prev = block;
+        half->next = block->next;
+        if (half->next != NULL) {
+            half->next->prev = half;
+        }
+        block->next = half;
+        block_set_size(block, (size_t) 1 << k);
+        buddy_push(arena, half, k);
+    }
+    region->live++;
+    block_set_id(block);
+    block->usage = actual_size;
+    return block + 1;
+}
+
+/**
+ * void buddy_release(struct mem_block *block)
+ *
+ * Frees a buddy block, merging it with its buddy for as long as the buddy is
+ * free and whole. A tree with nothing in use is unmapped. Must be called with
+ * the block's arena locked.
+ *
+ * @param block       block to free
+ * @return void
+  */
+static void buddy_release(struct mem_block *block)
+{
+    struct region *region = block_region(block);
+    struct arena *arena = region->arena;
+    block->usage = 0;
+    region->live--;
+    size_t size = block_size(block);
+    size_t tree = (size_t) 1 << region->order;
+    while (size < tree) {
+        size_t offset = (void *) block - (void *) region->start;
+        struct mem_block *buddy = (void *) region->start + (offset ^ size);
+        if (buddy->usage != 0 || block_size(buddy) != size) {
+            break;
+        }
+        buddy_unlink(arena, buddy, __builtin_ctzl(size));
+        if (buddy < block) {
+            join(buddy, block);
+            block = buddy;
+        } else {
+            join(block, buddy);
+        }
+        size <<= 1;
+    }
+    if (region->live == 0) {
+        region_unmap(region);
+        return;
+    }
+    buddy_push(arena, block, __builtin_ctzl(size));
+}
+
+/**
+ * void *reuse_locked(size_t size)
+ *
+ * Searches the free space with the configured policy, sweeping the arena
+ * first if coalescing is deferred and the search fails. Must be called with
+ * the calling thread's arena locked.
+ *
+ * @param size        memory size
+ * @return void       void pointer
+  */
+static void *reuse_locked(size_t size)
+{
+    /*using free space management (FSM) algorithms, find a block of memory that we can reuse. Return NULL if no suitable block is found.*/
+    STATS_ADD(fit_searches, 1);
+    void *ptr = g_config.fit(size);
+    if (ptr == NULL && g_config.coalesce_deferred && arena_coalesce(thread_arena())) {
+        ptr = g_config.fit(size);
+    }
+    return ptr;
+}
+
+/**
+ * void *reuse(size_t size)
+ *
+ * Driver for FSM system to select memory search method.
+ *
+ * @param size        memory size
+ * @return void       void
+  */
+void *reuse(size_t size)
+{
+    struct arena *arena = arena_lock_thread();
+    void *ptr = reuse_locked(size);
+    pthread_mutex_unlock(&arena->lock);
+    return ptr;
+}
+
+/**
+ * void *malloc_name(size_t size)
+ *
+ * Malloc name to allocate dynamic memory
+ *
+ * @param size        memory size
+ * @return void       void pointer
+  */
+void *malloc(size_t size)
+{
+    /* allocate memory. You'll first check if you can reuse an existing block. If not, map a new memory region.*/
+    return malloc_name(size, NULL);
+}
+
+/**
+ * void release(struct mem_block *block)
+ *
+ * Returns a block to its arena. The block is coalesced with its neighbours
+ * through its prev/next boundary tags (unless coalescing is deferred), and
+ * the region's live-block count tells when the region is empty and can be
+ * unmapped, so no list is walked. Must be called with the block's arena
+ * locked.
+ *
+ * @param block       block to free
+ * @return void
+  */
+static void release(struct mem_block *block)
+{
+    struct region *region = block_region(block);
+    struct arena *arena = region->arena;
+    arena->dirty = true;
+    if (g_config.purge != PURGE_OFF && !g_purge_background
+            && ++arena->purge_ticks >= PURGE_TICKS) {
+        arena->purge_ticks = 0;
+        purge_check(arena, PURGE_BLOCKS);
+        purge_shared(PURGE_BATCH);
+    }
+    if (region->order != 0) {
+        buddy_release(block);
+        return;
+    }
+    if (region->large) {
+        large_release(region);
+        return;
+    }
+    index_remove(block);
+    block->usage = 0;
+    region->live--;
+    if (!g_config.coalesce_deferred) {
+        block = coalesce(block);
+    }
+    index_insert(block);
+    if (region->live == 0) {
+        /* nothing in the region is in use any more, unmap it */
+        region_unmap(region);
+        return;
+    }
+    LOG("Free request successfully performed in region @ %p\n", region->start);
+}
+
+/**
+ * Pointers that lie neither in the slab range nor in a region of the page
+ * map were handed out by another allocator, typically the C library's, for
+ * memory allocated before this library was loaded. They are passed on to
+ * the next definition of the function, found with dlsym(RTLD_NEXT).
+ */
+static void *g_libc_free = NULL;
+static void *g_libc_realloc = NULL;
+static void *g_libc_usable_size = NULL;
+
+/**
+ * void *libc_function(void **cache, const char *name)
+ *
+ * Looks up the next definition of an allocator function, once.
+ *
+ * @param cache       where the address is kept
+ * @param name        function name
+ * @return void       function address, or NULL if there is none
+  */
+static void *libc_function(void **cache, const char *name)
+{
+    void *function = __atomic_load_n(cache, __ATOMIC_RELAXED);
+    if (function == NULL) {
+        function = dlsym(RTLD_NEXT, name);
+        __atomic_store_n(cache, function, __ATOMIC_RELAXED);
+    }
+    return function;
+}
+
+/**
+ * bool foreign(void *ptr)
+ *
+ * Tells whether a pointer was handed out by another allocator.
+ *
+ * @param ptr         data pointer
+ * @return bool       true if it is neither a slab object nor in a region
+  */
+static inline bool foreign(void *ptr)
+{
+    return !slab_owns(ptr) && pagemap_get(ptr) == NULL;
+}
+
+/**
+ * void foreign_free(void *ptr)
+ *
+ * Frees memory of another allocator. With none to hand it to, the memory
+ * is left alone.
+ *
+ * @param ptr         foreign data pointer
+ * @return void
+  */
+static void foreign_free(void *ptr)
+{
+    void (*libc_free)(void *) = libc_function(&g_libc_free, "free");
+    LOG("Forwarding free of foreign pointer %p\n", ptr);
+    if (libc_free != NULL) {
+        libc_free(ptr);
+    }
+}
+
+/**
+ * void deallocate(void *ptr, int class)
+ *
+ * Frees dynamic memory for free() and the sized frees.
+ *
+ * @param ptr         void pointer
+ * @param class       the thread cache class of a slab object, or -1
+ * @return void
+  */
+static void deallocate(void *ptr, int class)
+{
+    LOG("Free request @ %p\n", ptr);
+    if (ptr == NULL) {
+        return;
+    }
+    if (foreign(ptr)) {
+        foreign_free(ptr);
+        return;
+    }
+    stats_free(stats_size(ptr));
+    bool named = !slab_owns(ptr) && block_named((struct mem_block*) ptr - 1);
+#if ALLOCATOR_COMPACT_HEADER
+    if (named) {
+        name_clear((struct mem_block*) ptr - 1);
+    }
+#endif
+    if (!named && tcache_free(ptr, class)) {
+        return;
+    }
+    struct arena *arena = owner_arena(ptr); /* route back to the owning arena */
+    if (pthread_mutex_trylock(&arena->lock) != 0) {
+        if (remote_push(arena, ptr)) {
+            return;
+        }
+        pthread_mutex_lock(&arena->lock);
+    }
+    remote_drain(arena);
+    release_ptr(ptr);
+    pthread_mutex_unlock(&arena->lock);
+    if (g_purge_background && !g_purge_thread_started) {
+        purge_thread_start();
+    }
+}
+
+/**
+ * void free(void *ptr)
+ *
+ * Free dynamic memory
+ *
+ * @param *ptr       void pointer
+ * @return void
+  */
+void free(void *ptr)
+{
+    deallocate(ptr, -1);
+}
+
+/**
+ * int sized_class(void *ptr, size_t size)
+ *
+ * Derives the cache class of a slab object from the size it was allocated
+ * with, sparing a read of its slab's header. Objects are at least that size
+ * rounded up to a class. Heap blocks are left to their header, which sits
+ * right before the data.
+ *
+ * @param ptr         data pointer
+ * @param size        size passed when the memory was allocated
+ * @return int        class, or -1
+  */
+static int sized_class(void *ptr, size_t size)
+{
+    if (!slab_owns(ptr) || size > SLAB_MAX_SIZE) {
+        return -1;
+    }
+    return size == 0 ? 0 : (size - 1) / TCACHE_QUANTUM;
+}
+
+/**
+ * void free_sized(void *ptr, size_t size)
+ *
+ * Free dynamic memory whose size is known (C23)
+ *
+ * @param ptr         void pointer
+ * @param size        size passed when the memory was allocated
+ * @return void
+  */
+void free_sized(void *ptr, size_t size)
+{
+    deallocate(ptr, sized_class(ptr, size));
+}
+
+/**
+ * void free_aligned_sized(void *ptr, size_t alignment, size_t size)
+ *
+ * Free aligned dynamic memory whose size is known (C23)
+ *
+ * @param ptr         void pointer
+ * @param alignment   alignment passed when the memory was allocated
+ * @param size        size passed when the memory was allocated
+ * @return void
+  */
+void free_aligned_sized(void *ptr, size_t alignment, size_t size)
+{
+    (void) alignment; /* aligned blocks are freed like any other */
+    deallocate(ptr, sized_class(ptr, size));
+}
+
+/**
+ * C++ sized deallocation, operator delete(void *, std::size_t) and
+ * operator delete[](void *, std::size_t), by their mangled names, so C++
+ * programs get the sized path too. The unsized operators end up in free().
+ */
+void _ZdlPvm(void *ptr, size_t size)
+{
+    free_sized(ptr, size);
+}
+
+void _ZdaPvm(void *ptr, size_t size)
+{
+    free_sized(ptr, size);
+}
+
+/**
+ * size_t usable_size(struct mem_block *block)
+ *
+ * Bytes the owner of a block may use: its usage, or all of it in buddy and
+ * large regions, whose slack nobody else takes.
+ *
+ * @param block       memory block
+ * @return size_t     usable bytes
+  */
+static size_t usable_size(struct mem_block *block)
+{
+    if (!region_indexed(block_region(block))) {
+        return block_size(block) - sizeof(struct mem_block);
+    }
+    return block->usage - sizeof(struct mem_block);
+}
+
+/**
+ * size_t malloc_usable_size(void *ptr)
+ *
+ * Usable size of dynamic memory: at least what was asked for
+ *
+ * @param ptr         void pointer
+ * @return size_t     bytes that can be used, 0 for NULL
+  */
+size_t malloc_usable_size(void *ptr)
+{
+    if (ptr == NULL) {
+        return 0;
+    }
+    if (foreign(ptr)) {
+        size_t (*libc_usable_size)(void *) = libc_function(&g_libc_usable_size, "malloc_usable_size");
+        return libc_usable_size == NULL ? 0 : libc_usable_size(ptr);
+    }
+    if (slab_owns(ptr)) {
+        return slab_of(ptr)->size;
+    }
+    return usable_size((struct mem_block *) ptr - 1);
+}
+
+/* -- Batch allocation -- */
+
+/**
+ * malloc_batch() and free_batch() serve many requests under one hold of the
+ * arena lock. When the free space runs out, a batch gets a region sized for
+ * everything it still needs, up to BATCH_REGION_MAX bytes so it is still
+ * carved from a span, and carves it front to back, each block split off the
+ * tail of the one before. free_batch() bypasses the thread cache and takes
+ * each owning arena's lock once per run of pointers from that arena. Large
+ * requests are still served one by one.
+ */
+#define BATCH_REGION_MAX ((size_t) 1024 * 1024)
+
+/**
+ * size_t batch_region(size_t size, size_t count, void **out)
+ *
+ * Maps one region for up to 'count' requests and carves them from it in
+ * address order. Must be called with the calling thread's arena locked.
+ *
+ * @param size        memory size of each request
+ * @param count       requests still to serve
+ * @param out         receives the data pointers
+ * @return size_t     number of requests served
+  */
+static size_t batch_region(size_t size, size_t count, void **out)
+{
+    size_t actual_size = block_size_for(size);
+    size_t bytes = actual_size;
+    if (count <= BATCH_REGION_MAX / actual_size) {
+        bytes = actual_size * count;
+    } else if (actual_size < BATCH_REGION_MAX) {
+        bytes = BATCH_REGION_MAX / actual_size * actual_size;
+    }
+    size_t region_sz = region_size_for(bytes);
+#if ALLOCATOR_COMPACT_HEADER
+    /* only the first REGION_ALIGN bytes can hold block headers */
+    if (region_sz > REGION_ALIGN && actual_size < REGION_ALIGN) {
+        region_sz = REGION_ALIGN;
+    }
+#endif
+    struct mem_block *block = region_create(region_sz, region_sz - REGION_PROLOGUE, false, NULL);
+    if (block == NULL) {
+        return 0;
+    }
+    block_region(block)->live = 1;
+    block_set_id(block);
+    block->usage = actual_size;
+    index_insert(block);
+    out[0] = block + 1;
+    size_t done = 1;
+    while (done < count && extent_indexed(block) && free_space(block) >= actual_size) {
+        void *ptr = carve(block, actual_size);
+        out[done++] = ptr;
+        block = (struct mem_block *) ptr - 1;
+    }
+    return done;
+}
+
+/**
+ * size_t malloc_batch(size_t size, size_t count, void **out)
+ *
+ * Allocates 'count' blocks of 'size' bytes, taking the arena lock once
+ *
+ * @param size        memory size of each block
+ * @param count       number of blocks
+ * @param out         receives the data pointers
+ * @return size_t     number of blocks allocated; fewer than 'count' only if
+ *                    memory ran out
+  */
+size_t malloc_batch(size_t size, size_t count, void **out)
+{
+    LOG("Batch allocation request: %zu x %zu bytes\n", count, size);
+    if (size_too_large(size)) {
+        errno = ENOMEM;
+        return 0;
+    }
+    size_t done = 0;
+    thread_arena(); /* loads the configuration on first use */
+    if (size >= g_config.large_threshold) {
+        while (done < count && (out[done] = allocate(size, NULL, NULL)) != NULL) {
+            done++;
+        }
+        return done;
+    }
+    struct arena *arena = arena_lock_thread();
+    while (done < count) {
+        void *ptr = NULL;
+        if (size <= SLAB_MAX_SIZE && g_slab_span != 0) {
+            ptr = slab_alloc_locked(arena, size);
+        }
+        if (ptr == NULL) {
+            ptr = reuse_locked(size);
+        }
+        if (ptr != NULL) {
+            out[done++] = ptr;
+            continue;
+        }
+        size_t carved = batch_region(size, count - done, out + done);
+        if (carved == 0) {
+            break;
+        }
+        done += carved;
+    }
+    pthread_mutex_unlock(&arena->lock);
+    for (size_t i = 0; i < done; i++) {
+        stats_alloc(stats_size(out[i]));
+        if (g_config.scribble) {
+            memset(out[i], 0xAA, size);
+        }
+        if (!slab_owns(out[i])) {
+            block_name((struct mem_block *) out[i] - 1, NULL);
+        }
+    }
+    LOG("Successfully allocated %zu blocks\n", done);
+    return done;
+}
+
+/**
+ * void free_batch(void **ptrs, size_t count)
+ *
+ * Frees 'count' pointers, taking each owning arena's lock once per run of
+ * pointers from that arena. NULL pointers are skipped.
+ *
+ * @param ptrs        data pointers
+ * @param count       number of pointers
+ * @return void
+  */
+void free_batch(void **ptrs, size_t count)
+{
+    LOG("Batch free request: %zu pointers\n", count);
+    struct arena *locked = NULL;
+    for (size_t i = 0; i < count; i++) {
+        void *ptr = ptrs[i];
+        if (ptr == NULL) {
+            continue;
+        }
+        if (foreign(ptr)) { /* the lookup of free may allocate */
+            if (locked != NULL) {
+                pthread_mutex_unlock(&locked->lock);
+                locked = NULL;
+            }
+            foreign_free(ptr);
+            continue;
+        }
+        stats_free(stats_size(ptr));
+#if ALLOCATOR_COMPACT_HEADER
+        if (!slab_owns(ptr)) {
+            name_clear((struct mem_block*) ptr - 1);
+        }
+#endif
+        struct arena *arena = owner_arena(ptr);
+        if (arena != locked) {
+            if (locked != NULL) {
+                pthread_mutex_unlock(&locked->lock);
+            }
+            locked = arena;
+            pthread_mutex_lock(&locked->lock);
+            remote_drain(locked);
+        }
+        release_ptr(ptr);
+    }
+    if (locked != NULL) {
+        pthread_mutex_unlock(&locked->lock);
+    }
+    if (g_purge_background && !g_purge_thread_started) {
+        purge_thread_start();
+    }
+}
+
+/* -- Bump arenas -- */
+
+/**
+ * A mem_arena hands out memory with a bump pointer from chunks: regions
+ * mapped with region_map(), so usually carved from a span, that hold no
+ * blocks and are on no arena's region list. Objects have no header and are
+ * never freed one by one. arena_reset() releases every chunk but the home
+ * chunk, the first one, which also holds the mem_arena itself, and
+ * arena_destroy() releases them all, so a teardown costs one span release
+ * per chunk. Chunks start at CHUNK_MIN bytes and double up to CHUNK_MAX;
+ * after a reset the next chunk is sized for everything the arena's regular
+ * chunks held, so a workload that fills about the same amount every round
+ * maps one chunk per round. A request too big for the next chunk gets an
+ * oversize chunk of its own, which is kept on a separate list and does not
+ * count towards that size. A mem_arena has no lock: one thread at a time may
+ * use it.
+ */
+#define CHUNK_MIN ((size_t) 64 * 1024)
+#define CHUNK_MAX ((size_t) 4 * 1024 * 1024)
+#define CHUNK_ALIGN 16 /*!< Alignment of every object */
+
+struct mem_arena {
+    struct region *home;        /*!< First chunk, which holds this struct */
+    struct region *chunks;      /*!< Regular chunks, newest first; ends with home */
+    struct region *oversize;    /*!< Chunks mapped for a single request */
+    void *cursor;               /*!< Next free byte of the current chunk */
+    void *end;                  /*!< End of the current chunk */
+    size_t next_size;           /*!< Size of the next chunk */
+};
+
+/**
+ * struct region *chunk_map(size_t size)
+ *
+ * Maps a chunk with at least 'size' bytes after its prologue.
+ *
+ * @param size        bytes needed
+ * @return region     chunk descriptor, or NULL
+  */
+static struct region *chunk_map(size_t size)
+{
+    struct region *chunk = region_new();
+    if (chunk == NULL) {
+        return NULL;
+    }
+    bool zero;
+    chunk->size = region_size_for(size);
+    void *base = region_map(chunk->size, false, &chunk->span, &chunk->huge, &zero);
+    if (base == NULL) {
+        region_delete(chunk);
+        return NULL;
+    }
+    chunk->start = base + REGION_PROLOGUE;
+    return chunk;
+}
+
+/**
+ * void chunk_unmap(struct region *chunk)
+ *
+ * Gives a chunk's memory back to its span or the kernel.
+ *
+ * @param chunk       chunk descriptor
+ * @return void
+  */
+static void chunk_unmap(struct region *chunk)
+{
+    region_unmap_memory(chunk);
+    region_delete(chunk);
+}
+
+/**
+ * struct mem_arena *arena_create(void)
+ *
+ * Creates a bump arena
+ *
+ * @param void
+ * @return mem_arena  new arena, or NULL
+  */
+struct mem_arena *arena_create(void)
+{
+    thread_arena(); /* loads the configuration on first use */
+    struct region *chunk = chunk_map(CHUNK_MIN);
+    if (chunk == NULL) {
+        return NULL;
+    }
+    struct mem_arena *bump = (void *) chunk->start;
+    bump->home = chunk;
+    bump->chunks = chunk;
+    bump->oversize = NULL;
+    bump->cursor = bump + 1;
+    bump->end = region_base(chunk) + chunk->size;
+    bump->next_size = CHUNK_MIN * 2;
+    LOG("Created bump arena @ %p\n", bump);
+    return bump;
+}
+
+/**
+ * void *arena_grow(struct mem_arena *bump, size_t size)
+ *
+ * Serves a request the current chunk cannot hold from a new chunk. An
+ * oversize chunk, mapped for one request, is not made current, so the space
+ * left in the current one is not lost.
+ *
+ * @param bump        bump arena
+ * @param size        memory size
+ * @return void       void pointer, or NULL with errno ENOMEM
+  */
+static void *arena_grow(struct mem_arena *bump, size_t size)
+{
+    if (size > SIZE_MAX / 2) {
+        errno = ENOMEM;
+        return NULL;
+    }
+    bool dedicated = size + CHUNK_ALIGN > bump->next_size;
+    struct region *chunk = chunk_map(dedicated ? size + CHUNK_ALIGN : bump->next_size);
+    if (chunk == NULL) {
+        errno = ENOMEM;
+        return NULL;
+    }
+    void *ptr = (void *) (((uintptr_t) chunk->start + CHUNK_ALIGN - 1) & ~(uintptr_t) (CHUNK_ALIGN - 1));
+    if (dedicated) {
+        chunk->next = bump->oversize;
+        bump->oversize = chunk;
+        return ptr;
+    }
+    chunk->next = bump->chunks;
+    bump->chunks = chunk;
+    bump->cursor = ptr + size;
+    bump->end = region_base(chunk) + chunk->size;
+    if (bump->next_size < CHUNK_MAX) {
+        bump->next_size *= 2;
+    }
+    return ptr;
+}
+
+/**
+ * void *arena_alloc(struct mem_arena *bump, size_t size)
+ *
+ * Allocates from a bump arena: no header and no lock. The memory is released
+ * by arena_reset() or arena_destroy() only and must not be passed to free().
+ *
+ * @param bump        bump arena
+ * @param size        memory size
+ * @return void       16-byte aligned pointer, or NULL
+  */
+void *arena_alloc(struct mem_arena *bump, size_t size)
+{
+    uintptr_t cursor = ((uintptr_t) bump->cursor + CHUNK_ALIGN - 1) & ~(uintptr_t) (CHUNK_ALIGN - 1);
+    void *ptr;
+    if (size <= (uintptr_t) bump->end - cursor) {
+        ptr = (void *) cursor;
+        bump->cursor = ptr + size;
+    } else {
+        ptr = arena_grow(bump, size);
+    }
+    if (ptr != NULL && g_config.scribble) {
+        memset(ptr, 0xAA, size);
+    }
+    return ptr;
+}
+
+/**
+ * void arena_reset(struct mem_arena *bump)
+ *
+ * Frees everything allocated from a bump arena, releasing every chunk but
+ * the home chunk, which is reused
+ *
+ * @param bump        bump arena
+ * @return void
+  */
+void arena_reset(struct mem_arena *bump)
+{
+    struct region *home = bump->home;
+    size_t held = 0;
+    for (struct region *chunk = bump->chunks; chunk != NULL; ) {
+        struct region *next = chunk->next;
+        held += chunk->size;
+        if (chunk != home) {
+            chunk_unmap(chunk);
+        }
+        chunk = next;
+    }
+    for (struct region *chunk = bump->oversize; chunk != NULL; ) {
+        struct region *next = chunk->next;
+        chunk_unmap(chunk);
+        chunk = next;
+    }
+    home->next = NULL;
+    bump->chunks = home;
+    bump->oversize = NULL;
+    bump->cursor = bump + 1;
+    bump->end = region_base(home) + home->size;
+    if (held > bump->next_size) {
+        bump->next_size = held; /* one chunk for what the last round needed */
+    }
+    LOG("Reset bump arena @ %p\n", bump);
+}
+
+/**
+ * void arena_destroy(struct mem_arena *bump)
+ *
+ * Frees a bump arena and everything allocated from it
+ *
+ * @param bump        bump arena
+ * @return void
+  */
+void arena_destroy(struct mem_arena *bump)
+{
+    if (bump == NULL) {
+        return;
+    }
+    LOG("Destroying bump arena @ %p\n", bump);
+    struct region *chunk = bump->oversize;
+    while (chunk != NULL) {
+        struct region *next = chunk->next;
+        chunk_unmap(chunk);
+        chunk = next;
+    }
+    chunk = bump->chunks; /* home, which holds 'bump', comes last */
+    while (chunk != NULL) {
+        struct region *next = chunk->next;
+        chunk_unmap(chunk);
+        chunk = next;
+    }
+}
+
+/**
+ * void *calloc(size_t nmemb, size_t size)
+ *
+ * Calloc dynamic memory. Memory known to be zero already (fresh pages) is not
+ * cleared again.
+ *
+ * @param nmemb       number of elements
+ * @param size        element size
+ * @return void       void pointer, or NULL with errno ENOMEM on overflow
+  */
+void *calloc(size_t nmemb, size_t size)
+{
+    LOG("Calloc request @ %zu; size = %zu\n", nmemb, size);
+    size_t actual_size;
+    if (__builtin_mul_overflow(nmemb, size, &actual_size)) {
+        errno = ENOMEM;
+        return NULL;
+    }
+    bool zeroed;
+    void *ptr = allocate(actual_size, NULL, &zeroed);
+    if (ptr == NULL) {
+        return NULL;
+    }
+    /* the block is ours, so clearing it needs no lock */
+    if (!zeroed) {
+        memset(ptr, 0x00, actual_size);
+    }
+    return ptr;
+}
+
+/**
+ * Blocks that are alone in a region of at least REALLOC_MREMAP_MIN bytes that
+ * is mapped on its own (not carved from a span) are grown with mremap(), so the kernel moves page table entries instead of the
+ * data being copied. Not done with the compact header, whose regions have to
+ * stay REGION_ALIGN aligned.
+ */
+#define REALLOC_MREMAP_MIN ((size_t) 128 * 1024)
+
+/**
+ * void *realloc_in_place(struct mem_block *block, size_t actual_size)
+ *
+ * Tries to grow a block without copying it: by absorbing a free successor,
+ * or by remapping a large region that holds nothing else. Must be called
+ * with the block's arena locked.
+ *
+ * @param block        block to grow
+ * @param actual_size  aligned size including the header
+ * @return void        data pointer (moved if remapped), or NULL
+  */
+static void *realloc_in_place(struct mem_block *block, size_t actual_size)
+{
+    struct region *region = block_region(block);
+    struct mem_block *next = block->next;
+    if (region->order != 0) {
+        return NULL;
+    }
+    bool indexed = region_indexed(region);
+    if (indexed && next != NULL && next->usage == 0
+            && block_size(block) + block_size(next) >= actual_size) {
+        index_remove(next);
+        index_remove(block);
+        join(block, next);
+        block->usage = actual_size;
+        index_insert(block);
+        return block + 1;
+    }
+#if !ALLOCATOR_COMPACT_HEADER
+    if (block == region->start && next == NULL && region->span == NULL
+            && region->huge != HUGE_TLB && region->size >= REALLOC_MREMAP_MIN) {
+        size_t region_sz = region_size_for(actual_size);
+        /* the target is reserved and entered in the page map first, so the
+         * old pages can leave the map before another mapping may reuse them */
+        void *target = mmap(NULL, region_sz, PROT_NONE,
+                MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE, -1, 0);
+        if (target == MAP_FAILED) {
+            return NULL;
+        }
+        stats_map(0); /* inaccessible until the region lands on it */
+        if (!pagemap_set(target, region_sz, region)) {
+            pagemap_set(target, region_sz, NULL);
+            munmap(target, region_sz);
+            stats_unmap(0);
+            return NULL;
+        }
+        if (indexed) {
+            index_remove(block);
+        }
+        pagemap_set(region_base(region), region->size, NULL);
+        void *base = mremap(region_base(region), region->size, region_sz,
+                MREMAP_MAYMOVE | MREMAP_FIXED, target);
+        if (base == MAP_FAILED) {
+            pagemap_set(region_base(region), region->size, region);
+            pagemap_set(target, region_sz, NULL);
+            munmap(target, region_sz);
+            stats_unmap(0);
+            if (indexed) {
+                index_insert(block);
+            }
+            return NULL;
+        }
+        stats_map(region_sz - region->size);
+        struct arena *arena = region->arena;
+        if (arena->rover == block) {
+            arena->rover = base;
+        }
+        if (arena->purge_next == block) {
+            arena->purge_next = base;
+        }
+        if (region->huge != HUGE_OFF) {
+            arena->huge_bytes += region_sz - region->size;
+        }
+        block = base;
+        region->start = block;
+        region->size = region_sz;
+        block_init(block, region_sz, region);
+        block->usage = actual_size;
+        if (indexed) {
+            index_insert(block);
+        }
+        LOG("Remapped region to %p, %zu bytes\n", base, region_sz);
+        return block + 1;
+    }
+#endif
+    return NULL;
+}
 
 /**
- * void *malloc_name(size_t size, char *name)
+ * void *realloc(void *ptr, size_t size)
  *
- * Malloc name to allocate dynamic memory and provide name feature
+ * Realloc dynamic memory to extend malloc
  *
+ * @param *ptr        void pointer
  * @param size        memory size
- * @param name        pointer to memory name
- * @return void
+ * @return void       void pointer
   */
-void *malloc_name(size_t size, char *name){
+void *realloc(void *ptr, size_t size)
+{
+    LOG("Re-allocation request @ %p; size = %zu\n", ptr, size);
 
-    LOG("Allocation Requestion: %zu bytes\n", size);
-    /* set indicator for scribble flag */
-    scribble = false;
-    char *indicator = getenv("ALLOCATOR_SCRIBBLE");
-    if (indicator != NULL) {/* set scribble flag to true if indicator is NULL*/
-        if (strcmp(indicator, "1") == 0) {
-            scribble = true;
-        }
-    }
-    void *region_ptr = reuse(size);
-    pthread_mutex_lock(&alloc_mutex);
-    if (region_ptr == NULL) {
-        LOG("Region pointer was %s", "NULL\n");
-        size_t actual_size = size + sizeof(struct mem_block);
-        if (actual_size % 8 != 0) {
-            actual_size = actual_size + (8 - actual_size % 8);
-            LOG("Aligned size: %zu\n", actual_size);
-        }
-        int page_size = getpagesize();
-        size_t num_pages = actual_size / page_size;
-        if (actual_size % page_size != 0) {
-            num_pages = num_pages + 1;
-        }
-
-        /* calculate region_sz */
-        size_t region_sz = num_pages * page_size;
-
-        /* call mmap to allocate memory */
-        struct mem_block *block = mmap(
-            NULL,                           /* address, use NULL to let kernel decide */
-            region_sz,                      /* size of memory block to allocate */
-            PROT_READ | PROT_WRITE,         /* memory protection flags */
-            MAP_PRIVATE | MAP_ANONYMOUS,    /* type of mapping */
-            -1,                             /* file descriptor */
-            0                               /* offset in memory */
-        );
-        /* error message if allocate memory failed */
-        if (block == MAP_FAILED) {
-            perror("mmap error");
-            pthread_mutex_unlock(&alloc_mutex);
-            return NULL;
-        }
-        block->alloc_id = g_allocations++;
-        if(name == NULL){
-            char buffer[32];
-            sprintf(buffer, "%lu", block->alloc_id);
-            strcpy(block->name, "ALOCATOR ");
-            strcat(block->name, buffer);
-        } else {
-            strcpy(block->name, name);
-        }
+    /*
+    * Realloc algorithm:
+    * 1. create a new block of the requested size
+    * 2. copy the old contents to the new block
+    * 3. delete the old block
+    * 4. return pointer to the new block
+    *
+    * A few things to consider:
+    * - what if they realloc to the new block
+    *       -> just return the same pointer.
+    * - what if it is bigger
+    *       -> that is the case above (creating the new block), unless the block itself has space already,
+    *          its free successor can be absorbed, or it is alone in a large region (mremap).
+    * - what if it is smaller
+    *       -> resize the block
+    * - what if it is 0?
+    *       -> free the memory
+    */
 
-        block->size = region_sz;
-        block->usage = actual_size;
-        block->region_start = block;
-        block->region_size = region_sz;
-        block->next = NULL;
-        if (g_head == NULL) {
-            g_head = block;
-        } else {
-            struct mem_block *tail = g_head;
-            while (tail->next != NULL) {
-                tail = tail->next;
-            }
-            LOG("Updating tail: %p -> %p\n", tail, tail->next);
-            tail->next = block;
+
+    size_t actual_size = block_size_for(size);
+    LOG("Aligned size: %zu\n", actual_size);
+    if (ptr == NULL) {
+        return malloc(size);
+    }
+    if (size == 0) {
+        free(ptr);
+        return NULL;
+    }
+    /* checked before any growth path; the old block stays valid */
+    if (size_too_large(size)) {
+        errno = ENOMEM;
+        return NULL;
+    }
+    if (slab_owns(ptr)) {
+        size_t object_size = slab_of(ptr)->size;
+        if (size <= object_size) {
+            return ptr;
         }
-        if (scribble) {
-            memset(block + 1, 0xAA, size);
+        void *malloc_ptr = malloc(size);
+        if (malloc_ptr != NULL) {
+            memcpy(malloc_ptr, ptr, object_size);
+            free(ptr);
         }
-        pthread_mutex_unlock(&alloc_mutex);
-        LOG("Successfully allocated memory @ %p\n", block);
-        return block + 1;
-    } else {
-        LOG("Region pointer was %s", "not NULL\n");
-        if (scribble) {
-            memset(region_ptr, 0xAA, size);
-        }
-        struct mem_block *data_block = (struct mem_block*) region_ptr - 1;
-        if(name == NULL){
-            char buffer[32];
-            sprintf(buffer, "%lu", data_block->alloc_id);
-            strcpy(data_block->name, "ALOCATOR ");
-            strcat(data_block->name, buffer);
+        return malloc_ptr;
+    }
+    struct region *region = pagemap_get(ptr);
+    if (region == NULL) {
+        void *(*libc_realloc)(void *, size_t) = libc_function(&g_libc_realloc, "realloc");
+        LOG("Forwarding realloc of foreign pointer %p\n", ptr);
+        return libc_realloc == NULL ? NULL : libc_realloc(ptr, size);
+    }
+    struct mem_block *block = (struct mem_block*) ptr - 1;
+    /* a resize in place counts as a free and an allocation */
+    size_t old_size = stats_size(ptr);
+    /* aligned blocks may start off BLOCK_ALIGN; keep their end on it */
+    actual_size += -(uintptr_t) block & (BLOCK_ALIGN - 1);
+    /* the block's free tail can be carved by other threads until we lock */
+    pthread_mutex_lock(&region->arena->lock);
+    if (actual_size <= block_size(block)) {
+        if (!region_indexed(region)) { /* buddy and large slack is not indexed */
+            block->usage = actual_size;
         } else {
-            strcpy(data_block->name, name);
+            index_remove(block);
+            block->usage = actual_size;
+            index_insert(block);
         }
-        LOG("ALLOCATION ID: %lu\n", data_block->alloc_id);
-        pthread_mutex_unlock(&alloc_mutex);
-        LOG("Successfully return region_ptr @ %p\n", region_ptr);
-        return region_ptr;
+        pthread_mutex_unlock(&region->arena->lock);
+        stats_free(old_size);
+        stats_alloc(stats_size(ptr));
+        return ptr;
+    }
+    void *grown = realloc_in_place(block, actual_size);
+    pthread_mutex_unlock(&region->arena->lock);
+    if (grown != NULL) {
+        stats_free(old_size);
+        stats_alloc(stats_size(grown));
+        return grown;
+    }
+    void *malloc_ptr = malloc(size);
+    if (malloc_ptr == NULL) {
+        return NULL;
     }
+    memcpy(malloc_ptr, ptr, usable_size(block));
+
+    free(ptr);
+    return malloc_ptr;
 }
 
+/* -- Aligned allocation -- */
+
 /**
- * void *first_fit(size_t size)
+ * Aligned requests are placed in the free space of an indexed region like
+ * any other block, but with the header right before the first suitably
+ * aligned address, so free() and realloc() find it as usual. The bytes
+ * skipped stay in the free tail of the block before it (a free block keeps
+ * them as its own space), are indexed again if they can hold another block,
+ * and merge back when either block is freed. Requests the data alignment
+ * already satisfies (DATA_ALIGN) take the normal path; large ones get a
+ * region of their own. With the compact header every header has to lie in
+ * the first REGION_ALIGN bytes of its region, which limits alignments to
+ * REGION_ALIGN.
+ */
+
+/**
+ * void *aligned_carve(struct mem_block *block, size_t size, size_t align)
  *
- * A part of FSM system to find first fit memory
+ * Places an aligned allocation in the free space of a block, leaving the
+ * bytes before it to the block. Must be called with the arena locked.
  *
+ * @param block       block whose free space is used
  * @param size        memory size
- * @return void       void pointer
+ * @param align       alignment, a power of two
+ * @return void       aligned data pointer, or NULL if it does not fit
   */
-void *first_fit(size_t size)
+static void *aligned_carve(struct mem_block *block, size_t size, size_t align)
 {
-    /* first fit FSM implementation */
-    struct mem_block *block = g_head; /* get the head of the linked list */
-    size_t actual_size = size + sizeof(struct mem_block); /* calculate actual size = size + header */
-    if (actual_size % 8 != 0) {
-        actual_size = actual_size + (8 -actual_size % 8);
-        LOG("Aligned size: %zu\n", actual_size);
+    struct region *region = block_region(block);
+    uintptr_t start = (uintptr_t) block + block->usage;
+    uintptr_t data = (start + sizeof(struct mem_block) + align - 1) & ~(align - 1);
+    if (block->usage == 0 && data != start + sizeof(struct mem_block)) {
+        /* a free block keeps at least its header in front of the new one */
+        data = (start + 2 * sizeof(struct mem_block) + align - 1) & ~(align - 1);
     }
-    if (block == NULL) {
+    struct mem_block *aligned = (struct mem_block *) data - 1;
+    /* the block ends BLOCK_ALIGN aligned, so blocks split off it stay aligned */
+    uintptr_t end = (data + size + BLOCK_ALIGN - 1) & ~(uintptr_t) (BLOCK_ALIGN - 1);
+    if (end > (uintptr_t) block + block_size(block)) {
         return NULL;
     }
-    while (block != NULL) {
-        if (block->size - block->usage >= actual_size) {  /* find the first space */
-            if (block->usage == 0) { /* consider available space as required space */
-                block->alloc_id = g_allocations++;
-                block->usage = actual_size;
-                return block + 1;
-            } else { /* if find space has some other usage */
-                struct mem_block *create_block = (void*) block + block->usage; /* pointer to the create block */
-                create_block->alloc_id = g_allocations++;
-                create_block->size = block->size - block->usage;
-                create_block->usage = actual_size;
-                create_block->region_start = block->region_start;
-                create_block->region_size = block->region_size;
-                create_block->next = block->next;
-                block->next = create_block;
-                block->size = block->usage;
-                return create_block + 1;
-            }
+#if ALLOCATOR_COMPACT_HEADER
+    if ((void *) aligned - region_base(region) >= REGION_ALIGN) {
+        return NULL;
+    }
+#endif
+    index_remove(block);
+    region->live++;
+    if (aligned != block) {
+        block_init(aligned, (void *) block + block_size(block) - (void *) aligned, region);
+        aligned->prev = block;
+        aligned->next = block->next;
+        if (aligned->next != NULL) {
+            aligned->next->prev = aligned;
         }
-        block = block->next;
+        block->next = aligned;
+        block_set_size(block, (void *) aligned - (void *) block);
+        index_insert(block);
     }
-    return NULL;
+    block_set_id(aligned);
+    aligned->usage = end - (uintptr_t) aligned;
+    index_insert(aligned);
+    return aligned + 1;
 }
 
 /**
- * void *worst_fit(size_t size)
+ * void *aligned_alloc_locked(struct arena *arena, size_t size, size_t align, size_t space)
  *
- * A part of FSM system to find worst fit memory
+ * Places an aligned allocation in the arena's free space, or in a new region
+ * if none fits or the request is large. Must be called with the arena
+ * locked.
  *
+ * @param arena       the calling thread's arena
  * @param size        memory size
- * @return void       void pointer
+ * @param align       alignment, a power of two
+ * @param space       free space that holds the request wherever it starts
+ * @return void       aligned data pointer, or NULL
   */
-void *worst_fit(size_t size)
+static void *aligned_alloc_locked(struct arena *arena, size_t size, size_t align, size_t space)
 {
-    /* worst fit FSM implementation */
-    struct mem_block *block = g_head; /* get the head of the linked list */
-    size_t actual_size = size + sizeof(struct mem_block);
-    if (actual_size % 8 != 0) {
-        actual_size = actual_size + (8 -actual_size % 8);
-        LOG("Aligned size: %zu\n", actual_size);
-    }
-    int cnt = 0;
-    int worst = 0;
-    int i = 0;
-    struct mem_block *temp_block = g_head; /* get the head of the linked list in temp to manipulate it */
-    int temp_cnt = 0;
+    if (size < g_config.large_threshold) {
+        struct mem_block *block = index_first(arena, space);
+        if (block == NULL && g_config.coalesce_deferred && arena_coalesce(arena)) {
+            block = index_first(arena, space);
+        }
+        void *ptr = block == NULL ? NULL : aligned_carve(block, size, align);
+        if (ptr != NULL) {
+            return ptr;
+        }
+    }
+    size_t region_sz = region_size_for(space);
+#if ALLOCATOR_COMPACT_HEADER
+    if (region_sz < REGION_ALIGN) {
+        region_sz = REGION_ALIGN;
+    }
+#endif
+    struct mem_block *block = region_create(region_sz, region_sz - REGION_PROLOGUE, false, NULL);
     if (block == NULL) {
         return NULL;
     }
-    while (block != NULL) {
-        cnt++;
-        if (block->size - block->usage >= actual_size) { /* find the match */
-            int remaining = block->size - block->usage - actual_size;
-            if (remaining > worst) { /* calculate the waste and save it to worst */
-                worst = remaining;
-                i = cnt;
-            }
-        }
-        block = block->next;
-    }
-    while (temp_block != NULL) {
-        temp_cnt++;
-        if (temp_cnt == i) {
-            if (temp_block->usage == 0) { /* consider available space as required space */
-                temp_block->alloc_id = g_allocations++;
-                temp_block->usage = actual_size;
-                return temp_block + 1;
-            } else { /* if find worst space has some other usage */
-                struct mem_block *create_block = (void*) temp_block + temp_block->usage;
-                create_block->alloc_id = g_allocations++;
-                create_block->size = temp_block->size - temp_block->usage;
-                create_block->usage = actual_size;
-                create_block->region_start = temp_block->region_start;
-                create_block->region_size = temp_block->region_size;
-                create_block->next = temp_block->next;
-                temp_block->next = create_block;
-                temp_block->size = temp_block->usage;
-                return create_block + 1;
-            }
-        }
-        temp_block = temp_block->next;
+    index_insert(block);
+    void *ptr = aligned_carve(block, size, align);
+    if (ptr == NULL) {
+        region_unmap(block_region(block)); /* drops the block from the index */
     }
-    return NULL;
+    return ptr;
 }
 
 /**
- * void *best_fit(size_t size)
+ * void *aligned_allocate(size_t align, size_t size)
  *
- * A part of FSM system to find best fit memory
+ * Allocates dynamic memory at an 'align'-aligned address: from the thread's
+ * cache or the free space of its arena, else from a new region.
  *
+ * @param align       alignment, a power of two
  * @param size        memory size
- * @return void       void pointer
+ * @return void       aligned data pointer, or NULL with errno ENOMEM
   */
-void *best_fit(size_t size)
+static void *aligned_allocate(size_t align, size_t size)
 {
-    /*best fit FSM implementation */
-    size_t actual_size = size + sizeof(struct mem_block);
-    if(actual_size %8 != 0){
-        actual_size = actual_size + (8 -actual_size % 8);
-        LOG("Aligned size: %zu\n", actual_size);
-    }
-    struct mem_block *block = g_head;
-    int cnt = 0;
-    int best = INT_MAX;
-    int i = 0;
-    struct mem_block *temp_block = g_head;/* get the head of the linked list in temp to manipulate it */
-    int temp_cnt = 0;
-    if (block == NULL) {
+    LOG("Aligned allocation request: %zu bytes, %zu aligned\n", size, align);
+    if (align <= DATA_ALIGN) {
+        return allocate(size, NULL, NULL);
+    }
+    /* the worst case: a header kept in front, the alignment and the tail */
+    size_t space = sizeof(struct mem_block) + align + BLOCK_ALIGN;
+#if ALLOCATOR_COMPACT_HEADER
+    if (align > REGION_ALIGN) {
+        errno = ENOMEM;
         return NULL;
     }
-    while (block != NULL) {
-        cnt++;
-        if (block->size - block->usage >= actual_size) {
-            int remaining = block->size - block->usage - actual_size;
-            if (remaining < best) {/* calculate the waste and save it to best */
-                LOG("Inside Loop, cnt: %d, remaining: %d, best: %d, i: %d, block->name: %s\n", cnt, remaining, best, i, block->name);
-                best = remaining;
-                LOG("Inside Loop, setting i to %d\n", cnt);
-                i = cnt;
-            }
-        }
-        block = block->next;
-    }
-    LOG("Found i: %d\n", i);
-    LOG("best was: %d\n", best);
-    while (temp_block != NULL) {
-        temp_cnt++;
-        if (temp_cnt == i) { /* find the match */
-            if (temp_block->usage == 0) {
-                temp_block->alloc_id = g_allocations++;
-                temp_block->usage = actual_size;
-                return temp_block + 1;
-            } else { /* if find best space has some other usage */
-                struct mem_block *create_block = (void*) temp_block + temp_block->usage;
-                create_block->alloc_id = g_allocations++;
-                create_block->size = temp_block->size - temp_block->usage;
-                create_block->usage = actual_size;
-                create_block->region_start = temp_block->region_start;
-                create_block->region_size = temp_block->region_size;
-                create_block->next = temp_block->next;
-                temp_block->next = create_block;
-                temp_block->size = temp_block->usage;
-                return create_block + 1;
-            }
+#endif
+    if (size > SIZE_MAX - space - sizeof(struct mem_block) - BLOCK_ALIGN) {
+        errno = ENOMEM;
+        return NULL;
+    }
+    space += block_size_for(size);
+    void *ptr = tcache_alloc_aligned(size, align);
+    if (ptr == NULL) {
+        struct arena *arena = arena_lock_thread();
+        ptr = aligned_alloc_locked(arena, size, align, space);
+        pthread_mutex_unlock(&arena->lock);
+        if (ptr == NULL) {
+            errno = ENOMEM;
+            return NULL;
         }
-        temp_block = temp_block->next;
     }
-    return NULL;
+    stats_alloc(stats_size(ptr));
+    if (g_config.scribble) {
+        memset(ptr, 0xAA, size);
+    }
+    if (!slab_owns(ptr)) {
+        block_name((struct mem_block *) ptr - 1, NULL);
+    }
+    LOG("Successfully return aligned block @ %p\n", ptr);
+    return ptr;
 }
 
 /**
- * void *reuse(size_t size)
+ * int posix_memalign(void **memptr, size_t alignment, size_t size)
  *
- * Driver for FSM system to select memory search method.
+ * Allocates dynamic memory at an aligned address
  *
+ * @param memptr      receives the data pointer
+ * @param alignment   a power of two multiple of sizeof(void *)
  * @param size        memory size
- * @return void       void
+ * @return int        0, EINVAL for a bad alignment or ENOMEM
   */
-void *reuse(size_t size)
+int posix_memalign(void **memptr, size_t alignment, size_t size)
 {
-    pthread_mutex_lock(&alloc_mutex);
-    /*using free space management (FSM) algorithms, find a block of memory that we can reuse. Return NULL if no suitable block is found.*/
-    char *algo = getenv("ALLOCATOR_ALGORITHM");
-    if (algo == NULL) {
-        algo = "first_fit";
+    if (alignment % sizeof(void *) != 0 || (alignment & (alignment - 1)) != 0
+            || alignment == 0) {
+        return EINVAL;
     }
-    if (strcmp(algo, "first_fit") == 0) {
-        void *ptr = first_fit(size);
-        pthread_mutex_unlock(&alloc_mutex);
-        return ptr;
-    } else if (strcmp(algo, "best_fit") == 0) {
-        void *ptr = best_fit(size);
-        pthread_mutex_unlock(&alloc_mutex);
-        return ptr;
-    } else if (strcmp(algo, "worst_fit") == 0) {
-        void *ptr = worst_fit(size);
-        pthread_mutex_unlock(&alloc_mutex);
-        return ptr;
+    int saved = errno; /* posix_memalign reports errors by its result only */
+    void *ptr = aligned_allocate(alignment, size);
+    if (ptr == NULL) {
+        errno = saved;
+        return ENOMEM;
     }
-    pthread_mutex_unlock(&alloc_mutex);
-    return NULL;
+    *memptr = ptr;
+    return 0;
 }
 
 /**
- * void *malloc_name(size_t size)
+ * void *aligned_alloc(size_t alignment, size_t size)
  *
- * Malloc name to allocate dynamic memory
+ * Allocates dynamic memory at an aligned address (C11)
  *
+ * @param alignment   a power of two
  * @param size        memory size
- * @return void       void pointer
+ * @return void       void pointer, or NULL with errno EINVAL or ENOMEM
   */
-void *malloc(size_t size)
+void *aligned_alloc(size_t alignment, size_t size)
 {
-    /* allocate memory. You'll first check if you can reuse an existing block. If not, map a new memory region.*/
-    return malloc_name(size, NULL);
+    if (alignment == 0 || (alignment & (alignment - 1)) != 0) {
+        errno = EINVAL;
+        return NULL;
+    }
+    return aligned_allocate(alignment, size);
 }
 
 /**
- * void free(void *ptr)
+ * void *memalign(size_t alignment, size_t size)
  *
- * Free dynamic memory
+ * Allocates dynamic memory at an aligned address (obsolete). Alignments that
+ * are not a power of two are rounded up to one.
  *
- * @param *ptr       void pointer
- * @return void
+ * @param alignment   alignment
+ * @param size        memory size
+ * @return void       void pointer, or NULL with errno EINVAL or ENOMEM
   */
-void free(void *ptr)
+void *memalign(size_t alignment, size_t size)
 {
-    /*TODO: free memory. If the containing region is empty (i.e., there are no more blocks in use), then it should be unmapped.*/
-    pthread_mutex_lock(&alloc_mutex);
-    LOG("Free request @ %p\n", ptr);
-    bool free_region = true;
-    if (ptr == NULL) {
-        pthread_mutex_unlock(&alloc_mutex);
-        return;
-    }
-    /* Free block */
-    struct mem_block *block = (struct mem_block*) ptr - 1;
-    block->usage = 0;
-    struct mem_block *next_region = NULL;
-    struct mem_block *tail = block->region_start;
-    /* check to see if region is empty triger free_region flag */
-    while (tail != NULL)
-    {
-        if (tail->alloc_id != block->alloc_id)
-        {
-            if (tail->region_start != block->region_start)
-            {
-                next_region = tail->region_start;
-                break;
-            }
-            if (tail->usage != 0)
-            {
-                free_region = false;
-                pthread_mutex_unlock(&alloc_mutex);
-                LOG("Free request successfully performed in free_region @ %p\n", tail);
-                return;
-            }
-        }
-        tail = tail->next;
+    if (alignment > SIZE_MAX / 2 + 1) {
+        errno = EINVAL;
+        return NULL;
     }
-    /* if free_reqion flag triggers in free block section, then free region */
-    if (free_region)
-    {
-        void *block_draft = block->region_start;
-        munmap(block->region_start, block->region_size);
-        if (block_draft == g_head)
-        {
-            g_head = next_region;
-        } else {
-            struct mem_block *previous = g_head;
-            while (previous->next != block)
-            {
-                if (previous->next == block_draft)
-                {
-                    break;
-                } else {
-                    previous = previous->next;
-                }
-            }
-            previous->next = next_region;
-        }
+    size_t align = 1;
+    while (align < alignment) {
+        align <<= 1;
     }
-    pthread_mutex_unlock(&alloc_mutex);
+    return aligned_allocate(align, size);
 }
 
 /**
- * void *calloc(size_t nmemb, size_t size)
+ * void *valloc(size_t size)
  *
- * Calloc dynamic memory
+ * Allocates dynamic memory at a page-aligned address (obsolete)
  *
- * @param nmemb       void pointer
  * @param size        memory size
  * @return void       void pointer
   */
-void *calloc(size_t nmemb, size_t size)
+void *valloc(size_t size)
 {
-    LOG("Calloc request @ %ld; size = %zu\n", nmemb, size);
-    size_t actual_size = nmemb * size;
-    void *ptr = malloc(actual_size);
-    if (ptr == NULL) {
+    return aligned_allocate(getpagesize(), size);
+}
+
+/**
+ * void *pvalloc(size_t size)
+ *
+ * Allocates whole pages at a page-aligned address (obsolete): the size is
+ * rounded up to a multiple of the page size.
+ *
+ * @param size        memory size
+ * @return void       void pointer, or NULL with errno ENOMEM
+  */
+void *pvalloc(size_t size)
+{
+    size_t page_size = getpagesize();
+    if (size > SIZE_MAX - page_size) {
+        errno = ENOMEM;
         return NULL;
     }
-    /* for calloc we malloc and set it to zero */
-    pthread_mutex_lock(&alloc_mutex);
-    memset(ptr, 0x00, actual_size);
-    pthread_mutex_unlock(&alloc_mutex);
-    return ptr;
+    size = (size + page_size - 1) & ~(page_size - 1);
+    return aligned_allocate(page_size, size == 0 ? page_size : size);
 }
 
 /**
- * void *realloc(void *ptr, size_t size)
+ * void allocator_stats_get(struct allocator_stats *stats)
  *
- * Realloc dynamic memory to extend malloc
+ * Sums the statistics shards of all threads. Counters of running threads
+ * may move while they are read, so the snapshot is not exact.
  *
- * @param *ptr        void pointer
- * @param size        memory size
- * @return void       void pointer
+ * @param stats       receives the counters
+ * @return void
   */
-void *realloc(void *ptr, size_t size)
+void allocator_stats_get(struct allocator_stats *stats)
 {
-    LOG("Re-allocation request @ %p; size = %zu\n", ptr, size);
+    size_t *to = (size_t *) stats;
+    pthread_mutex_lock(&g_stats_lock);
+    memcpy(stats, &g_stats_retired, sizeof(struct allocator_stats));
+    for (struct stats_shard *shard = g_stats_shards; shard != NULL; shard = shard->next) {
+        size_t *from = (size_t *) &shard->counters;
+        for (size_t i = 0; i < STATS_FIELDS; i++) {
+            to[i] += __atomic_load_n(&from[i], __ATOMIC_RELAXED);
+        }
+    }
+    pthread_mutex_unlock(&g_stats_lock);
+}
 
-    /*
-    * Realloc algorithm:
-    * 1. create a new block of the requested size
-    * 2. copy the old contents to the new block
-    * 3. delete the old block
-    * 4. return pointer to the new block
-    *
-    * A few things to consider:
-    * - what if they realloc to the new block
-    *       -> just return the same pointer.
-    * - what if it is bigger
-    *       -> that is the case above (creating the new block), unless the block itself has space already.
-    * - what if it is smaller
-    *       -> resize the block
-    * - what if it is 0?
-    *       -> free the memory
-    */
+/**
+ * struct mallinfo2 mallinfo2(void)
+ *
+ * Memory usage in the C library's format. Mapped memory is reported as the
+ * arena, usable bytes of live allocations as in use and the rest of the
+ * mapping as free; the fields this allocator has no notion of are 0.
+ *
+ * @return mallinfo2  memory usage
+  */
+struct mallinfo2 mallinfo2(void)
+{
+    struct allocator_stats stats;
+    allocator_stats_get(&stats);
+    struct mallinfo2 info = { 0 };
+    info.arena = stats.mapped;
+    info.uordblks = stats.in_use;
+    info.fordblks = stats.mapped > stats.in_use ? stats.mapped - stats.in_use : 0;
+    return info;
+}
 
+/**
+ * void allocator_log_flush(void)
+ *
+ * Writes out the log records buffered by all threads. Does nothing when
+ * built with LOGGER=0.
+ *
+ * @return void
+  */
+void allocator_log_flush(void)
+{
+    logger_flush();
+}
 
-    size_t actual_size = size + sizeof(struct mem_block);
-    if (actual_size % 8 != 0) {
-        actual_size = actual_size + (8 -actual_size % 8);
-        LOG("Aligned size: %zu\n", actual_size);
-    }
-    if (ptr == NULL) {
-        return malloc(size);
-    }
-    if (size == 0) {
-        free(ptr);
-        return NULL;
+/**
+ * void stats_dump(void)
+ *
+ * Prints the statistics at exit when ALLOCATOR_STATS is set. Writes to stderr
+ * directly, since stdio may allocate.
+ *
+ * @return void
+  */
+__attribute__((destructor)) static void stats_dump(void)
+{
+    if (!g_config.stats) {
+        return;
     }
-    struct mem_block *block = (struct mem_block*) ptr - 1;
-    if (actual_size <= block->size) {
-        block->usage = actual_size;
-        return ptr;
-    } else if (actual_size > block->size) {
-        void *malloc_ptr = malloc(size);
-        pthread_mutex_lock(&alloc_mutex);
-        memcpy(malloc_ptr, ptr, block->usage - sizeof(struct mem_block));
-        pthread_mutex_unlock(&alloc_mutex);
-
-        free(ptr);
-        return malloc_ptr;
+    struct allocator_stats stats;
+    allocator_stats_get(&stats);
+    char message[256];
+    int length = snprintf(message, sizeof(message),
+            "allocator: %zu bytes mapped (%zu mmap, %zu munmap calls), %zu bytes in use\n"
+            "allocator: %zu fit searches, %zu extents visited\n",
+            stats.mapped, stats.mmaps, stats.munmaps, stats.in_use,
+            stats.fit_searches, stats.fit_visits);
+    write(STDERR_FILENO, message, length < (int) sizeof(message) ? length : sizeof(message) - 1);
+    for (int i = 0; i < ALLOCATOR_STATS_CLASSES; i++) {
+        if (stats.allocs[i] == 0 && stats.frees[i] == 0) {
+            continue;
+        }
+        length = snprintf(message, sizeof(message), "allocator: %s%zu bytes: %zu allocs, %zu frees\n",
+                i == ALLOCATOR_STATS_CLASSES - 1 ? "over " : "up to ",
+                (size_t) 16 << (i == ALLOCATOR_STATS_CLASSES - 1 ? i - 1 : i),
+                stats.allocs[i], stats.frees[i]);
+        write(STDERR_FILENO, message, length < (int) sizeof(message) ? length : sizeof(message) - 1);
     }
-    return NULL;
 }
 
 /**
@@ -525,31 +5511,67 @@ void save_memory(FILE *fd)
     }
 
     fputs("-- Current Memory State --\n", fd);
-    struct mem_block *current_block = g_head;
-    struct mem_block *current_region = NULL;
-    while (current_block != NULL) {
-        if (current_block->region_start != current_region) {
-            current_region = current_block->region_start;
+    for (unsigned int i = 0; i < g_arena_count; i++) {
+        struct region *current_region = g_arenas[i].regions;
+        while (current_region != NULL) {
             char s[1024];
             sprintf(s, "[REGION] %p-%p %zu\n",
-                    current_region,
-                    (void *) current_region + current_region->region_size,
-                    current_region->region_size);
+                    region_base(current_region),
+                    region_base(current_region) + current_region->size,
+                    current_region->size);
+            fputs(s, fd);
+            struct mem_block *current_block = current_region->start;
+            while (current_block != NULL) {
+                char s2[1024];
+                unsigned long alloc_id;
+                char name[32];
+                block_label(current_block, &alloc_id, name);
+                sprintf(s2, "[BLOCK]  %p-%p (%lu) '%s' %zu %zu %zu\n",
+                        current_block,
+                        (void *) current_block + block_size(current_block),
+                        alloc_id,
+                        name,
+                        block_size(current_block),
+                        current_block->usage,
+                        current_block->usage == 0
+                            ? 0 : current_block->usage - sizeof(struct mem_block));
+
+                fputs(s2, fd);
+                current_block = current_block->next;
+            }
+            current_region = current_region->next;
+        }
+        if (g_arenas[i].fit_requests != 0) {
+            char s[1024];
+            sprintf(s, "[ROVER]  %p %lu %lu\n", g_arenas[i].rover,
+                    g_arenas[i].fit_requests, g_arenas[i].fit_visits);
+            fputs(s, fd);
+        }
+        if (g_arenas[i].purged != 0) {
+            char s[1024];
+            sprintf(s, "[PURGE]  %u %zu\n", i, g_arenas[i].purged);
+            fputs(s, fd);
+        }
+        if (g_config.hugepage != HUGE_OFF) {
+            char s[1024];
+            sprintf(s, "[HUGE]   %u %zu\n", i, g_arenas[i].huge_bytes);
             fputs(s, fd);
         }
-        char s2[1024];
-        sprintf(s2, "[BLOCK]  %p-%p (%lu) '%s' %zu %zu %zu\n",
-                current_block,
-                (void *) current_block + current_block->size,
-                current_block->alloc_id,
-                current_block->name,
-                current_block->size,
-                current_block->usage,
-                current_block->usage == 0
-                    ? 0 : current_block->usage - sizeof(struct mem_block));
-
-        fputs(s2, fd);
-        current_block = current_block->next;
+    }
+    if (g_config.hugepage != HUGE_OFF) {
+        char s[1024];
+        sprintf(s, "[HUGE]   backed %zu\n", huge_backed());
+        fputs(s, fd);
+    }
+    for (void *p = g_slab_base; p < g_slab_top; p += SLAB_SIZE) {
+        struct slab *slab = p;
+        if (slab->arena == NULL) {
+            continue; /* retired */
+        }
+        char s[1024];
+        sprintf(s, "[SLAB]   %p-%p %zu %u %u\n",
+                p, p + SLAB_SIZE, slab->size, slab->used, slab->capacity);
+        fputs(s, fd);
     }
 }
 
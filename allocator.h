@@ -11,6 +11,7 @@
 #include <stddef.h>
 #include <stdbool.h>
 #include <stdio.h>
+#include <malloc.h>
 
 /* -- Global variable -- */
 // bool scribble = false;
@@ -58,6 +59,26 @@ void *worst_fit(size_t size);
   */
 void *best_fit(size_t size);
 
+/**
+ * void *next_fit(size_t size)
+ *
+ * A part of FSM system to find next fit memory
+ *
+ * @param size        memory size
+ * @return void       void pointer
+  */
+void *next_fit(size_t size);
+
+/**
+ * void *buddy_fit(size_t size)
+ *
+ * A part of FSM system to allocate from power-of-two buddy trees
+ *
+ * @param size        memory size
+ * @return void       void pointer
+  */
+void *buddy_fit(size_t size);
+
 /**
  * print_memory
  *
@@ -87,6 +108,126 @@ void save_memory(FILE *fd);
   */
 void *malloc_name(size_t size, char *name);
 
+/**
+ * size_t malloc_batch(size_t size, size_t count, void **out)
+ *
+ * Allocates 'count' blocks of 'size' bytes, taking the arena lock once
+ *
+ * @param size        memory size of each block
+ * @param count       number of blocks
+ * @param out         receives the data pointers
+ * @return size_t     number of blocks allocated
+  */
+size_t malloc_batch(size_t size, size_t count, void **out);
+
+/**
+ * void free_batch(void **ptrs, size_t count)
+ *
+ * Frees 'count' pointers, taking each owning arena's lock once per run
+ *
+ * @param ptrs        data pointers (NULL entries are skipped)
+ * @param count       number of pointers
+ * @return void
+  */
+void free_batch(void **ptrs, size_t count);
+
+/** Bump arena, see arena_create() */
+struct mem_arena;
+
+/**
+ * struct mem_arena *arena_create(void)
+ *
+ * Creates a bump arena: memory allocated from it is freed all at once
+ *
+ * @param void
+ * @return mem_arena  new arena, or NULL
+  */
+struct mem_arena *arena_create(void);
+
+/**
+ * void *arena_alloc(struct mem_arena *arena, size_t size)
+ *
+ * Allocates from a bump arena, without a header or a lock. The memory must
+ * not be passed to free(); an arena must not be used by two threads at once.
+ *
+ * @param arena       bump arena
+ * @param size        memory size
+ * @return void       16-byte aligned pointer, or NULL
+  */
+void *arena_alloc(struct mem_arena *arena, size_t size);
+
+/**
+ * void arena_reset(struct mem_arena *arena)
+ *
+ * Frees everything allocated from a bump arena, keeping the arena
+ *
+ * @param arena       bump arena
+ * @return void
+  */
+void arena_reset(struct mem_arena *arena);
+
+/**
+ * void arena_destroy(struct mem_arena *arena)
+ *
+ * Frees a bump arena and everything allocated from it
+ *
+ * @param arena       bump arena
+ * @return void
+  */
+void arena_destroy(struct mem_arena *arena);
+
+/**
+ * Size classes of struct allocator_stats: class i counts blocks of up to
+ * 16 << i usable bytes, the last class all larger ones.
+ */
+#define ALLOCATOR_STATS_CLASSES 24
+
+/**
+ * Counters kept by the allocator, see allocator_stats_get(). Allocations
+ * are counted with the size of their slab object, or of their block without
+ * the header.
+ */
+struct allocator_stats {
+    size_t mapped;          /*!< Bytes mapped for the heap and its metadata */
+    size_t in_use;          /*!< Bytes of live allocations */
+    size_t mmaps;           /*!< mmap() and mremap() calls */
+    size_t munmaps;         /*!< munmap() calls */
+    size_t fit_searches;    /*!< Free space searches */
+    size_t fit_visits;      /*!< Free extents or blocks looked at by them */
+    size_t allocs[ALLOCATOR_STATS_CLASSES]; /*!< Allocations per size class */
+    size_t frees[ALLOCATOR_STATS_CLASSES];  /*!< Frees per size class */
+};
+
+/**
+ * void allocator_stats_get(struct allocator_stats *stats)
+ *
+ * Reads the allocator's counters, summed over all threads
+ *
+ * @param stats       receives the counters
+ * @return void
+  */
+void allocator_stats_get(struct allocator_stats *stats);
+
+/**
+ * struct mallinfo2 mallinfo2(void)
+ *
+ * Memory usage in the C library's format
+ *
+ * @param void
+ * @return mallinfo2  memory usage
+  */
+struct mallinfo2 mallinfo2(void);
+
+/**
+ * void allocator_log_flush(void)
+ *
+ * Writes out buffered log messages (built with LOGGER=1)
+ *
+ * @param void
+ * @return void
+  */
+void allocator_log_flush(void);
+
 /* -- C Memory API functions -- */
 void *malloc(size_t size);
 
@@ -100,6 +241,39 @@ void *malloc(size_t size);
   */
 void free(void *ptr);
 
+/**
+ * void free_sized(void *ptr, size_t size)
+ *
+ * Free dynamic memory whose size is known (C23)
+ *
+ * @param ptr         void pointer
+ * @param size        size passed when the memory was allocated
+ * @return void
+  */
+void free_sized(void *ptr, size_t size);
+
+/**
+ * void free_aligned_sized(void *ptr, size_t alignment, size_t size)
+ *
+ * Free aligned dynamic memory whose size is known (C23)
+ *
+ * @param ptr         void pointer
+ * @param alignment   alignment passed when the memory was allocated
+ * @param size        size passed when the memory was allocated
+ * @return void
+  */
+void free_aligned_sized(void *ptr, size_t alignment, size_t size);
+
+/**
+ * size_t malloc_usable_size(void *ptr)
+ *
+ * Usable size of dynamic memory: at least what was asked for
+ *
+ * @param ptr         void pointer
+ * @return size_t     bytes that can be used, 0 for NULL
+  */
+size_t malloc_usable_size(void *ptr);
+
 /**
  * void *calloc(size_t nmemb, size_t size)
  *
@@ -122,9 +296,93 @@ void *calloc(size_t nmemb, size_t size);
   */
 void *realloc(void *ptr, size_t size);
 
+/**
+ * int posix_memalign(void **memptr, size_t alignment, size_t size)
+ *
+ * Allocates dynamic memory at an aligned address
+ *
+ * @param memptr      receives the data pointer
+ * @param alignment   a power of two multiple of sizeof(void *)
+ * @param size        memory size
+ * @return int        0, EINVAL or ENOMEM
+  */
+int posix_memalign(void **memptr, size_t alignment, size_t size);
+
+/**
+ * void *aligned_alloc(size_t alignment, size_t size)
+ *
+ * Allocates dynamic memory at an aligned address (C11)
+ *
+ * @param alignment   a power of two
+ * @param size        memory size
+ * @return void       void pointer
+  */
+void *aligned_alloc(size_t alignment, size_t size);
+
+/**
+ * void *memalign(size_t alignment, size_t size)
+ *
+ * Allocates dynamic memory at an aligned address (obsolete)
+ *
+ * @param alignment   alignment, rounded up to a power of two
+ * @param size        memory size
+ * @return void       void pointer
+  */
+void *memalign(size_t alignment, size_t size);
+
+/**
+ * void *valloc(size_t size)
+ *
+ * Allocates dynamic memory at a page-aligned address (obsolete)
+ *
+ * @param size        memory size
+ * @return void       void pointer
+  */
+void *valloc(size_t size);
+
+/**
+ * void *pvalloc(size_t size)
+ *
+ * Allocates whole pages at a page-aligned address (obsolete)
+ *
+ * @param size        memory size
+ * @return void       void pointer
+  */
+void *pvalloc(size_t size);
+
 
 /* -- Data Structures -- */
 
+struct region;
+
+#ifndef ALLOCATOR_COMPACT_HEADER
+#define ALLOCATOR_COMPACT_HEADER 0
+#endif
+
+#if ALLOCATOR_COMPACT_HEADER
+
+/**
+ * Compact block header, selected with 'make COMPACT_HEADER=1'. It is 32 bytes
+ * and naturally aligned, so data pointers are 16-byte aligned. Flags are kept
+ * in the low bits of 'size', the region is found by masking the block address
+ * and names/allocation IDs live in a side table (see malloc_name).
+ */
+struct mem_block {
+    /** Size of the block; the low four bits hold BLOCK_* flags */
+    size_t size;
+
+    /** Space used; if usage == 0, then the block has been freed. */
+    size_t usage;
+
+    /** Next block in the chain (NULL at the end of the region) */
+    struct mem_block *next;
+
+    /** Previous block in the region (NULL for the first block) */
+    struct mem_block *prev;
+};
+
+#else
+
 /**
  * Defines metadata structure for both memory 'regions' and 'blocks.' This
  * structure is prefixed before each allocation's data area.
@@ -161,9 +419,21 @@ struct mem_block {
      */
     size_t region_size;
 
-    /** Next block in the chain */
+    /** Next block in the chain (NULL at the end of the region) */
     struct mem_block *next;
 
+    /**
+     * Previous block in the region (NULL for the first block). Together with
+     * 'next' this acts as a boundary tag, giving free() both neighbours.
+     */
+    struct mem_block *prev;
+
+    /**
+     * Bookkeeping for the mapped region: owning arena, live-block count and
+     * position in the arena's region list.
+     */
+    struct region *region;
+
     /**
      * "Padding" to make the total size of this struct 100 bytes. This serves no
      * purpose other than to make memory address calculations easier. If you
@@ -171,8 +441,10 @@ struct mem_block {
      * and keep the total size at 100 bytes; test cases and tooling will assume
      * a 100-byte header.
      */
-    char padding[20];
+    char padding[4];
 } __attribute__((packed));
 
+#endif
+
 
 #endif
@@ -2,8 +2,17 @@
  * @file
  *
  * Helps facilitate debugging by providing basic logging functionality. Unlike
- * printf-style debugging, the log messages can be enabled/disabled by changing 
+ * printf-style debugging, the log messages can be enabled/disabled by changing
  * the value of LOGGER.
+ *
+ * With LOGGER set to 0 the macros expand to no code at all; the arguments are
+ * still type checked against the format but never evaluated. With LOGGER set
+ * to 1 a message is not printed where it is logged: LOG() copies the format,
+ * its location and up to LOGGER_ARGS arguments into a fixed-size record in
+ * the calling thread's ring, without locks, allocation or system calls other
+ * than reading the clock. The records are formatted and written to stderr by
+ * logger_flush(), which runs when a thread's ring fills up, on demand, and
+ * when the program exits.
  * Author: Rozita Teymourzadeh, Mathew Malensek
  * Date: 2020
  */
@@ -15,10 +24,10 @@
 #include <unistd.h>
 
 /**
- * If LOGGER is not set, it will be enabled by default.
+ * If LOGGER is not set, it will be disabled by default.
  */
 #ifndef LOGGER
-#define LOGGER 1
+#define LOGGER 0
 #endif
 
 /**
@@ -33,54 +42,482 @@
 #define LOGGER_COLOR_RED   "\033[0;31m"
 #define LOGGER_COLOR_BLUE  "\033[1;34m"
 #define LOGGER_COLOR_RESET "\033[0m"
+#else
+#define LOGGER_COLOR_RED   ""
+#define LOGGER_COLOR_BLUE  ""
+#define LOGGER_COLOR_RESET ""
 #endif
 
 /**
- * Prints an unformatted log message (single string).
+ * Type checks a log message against its format. Only used in unevaluated
+ * context, so it never runs.
+ */
+static inline __attribute__((format(printf, 1, 2)))
+int logger_check(const char *fmt, ...)
+{
+    (void) fmt;
+    return 0;
+}
+
+#if LOGGER
+
+#include <pthread.h>
+#include <stdarg.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <time.h>
+
+/**
+ * Arguments kept per record; further conversions in a format print as '?'.
+ */
+#define LOGGER_ARGS 4
+
+/**
+ * Records per thread ring, a power of two.
+ */
+#define LOGGER_RECORDS 1024
+
+/**
+ * One logged message. Formats, file and function names are kept as pointers,
+ * so they (and the strings passed for %s) must be string literals or
+ * otherwise outlive the next flush.
+ */
+struct logger_record {
+    uint64_t time;              /*!< CLOCK_MONOTONIC, in nanoseconds */
+    const char *file;
+    const char *func;
+    const char *fmt;
+    int line;
+    uint64_t args[LOGGER_ARGS]; /*!< Arguments in the order of the format */
+};
+
+/**
+ * Single producer, single consumer ring: the owning thread advances head, a
+ * flush (under g_logger_flush_lock) advances tail. The ring of a thread that
+ * has exited is marked idle and adopted by the next new thread.
+ */
+struct logger_ring {
+    uint64_t head;              /*!< Next record written by the owner */
+    uint64_t tail __attribute__((aligned(64))); /*!< Next record flushed */
+    int thread;                 /*!< Number printed with its records */
+    int idle;                   /*!< Owner has exited */
+    struct logger_ring *next;   /*!< All rings, newest first */
+    struct logger_record records[LOGGER_RECORDS];
+};
+
+/**
+ * Output of a flush, written to stderr whenever it fills up.
+ */
+struct logger_buffer {
+    size_t length;
+    char data[4096];
+};
+
+static struct logger_ring *g_logger_rings __attribute__((unused));
+static int g_logger_threads __attribute__((unused));
+static pthread_mutex_t g_logger_flush_lock __attribute__((unused)) = PTHREAD_MUTEX_INITIALIZER;
+static __thread struct logger_ring *t_logger_ring
+    __attribute__((unused, tls_model("initial-exec")));
+
+/**
+ * struct logger_ring *logger_ring(void)
+ *
+ * Returns the calling thread's ring, adopting an idle one or mapping a new
+ * one on first use.
+ *
+ * @return ring       the thread's ring, or NULL if none could be mapped
+ */
+static inline struct logger_ring *logger_ring(void)
+{
+    struct logger_ring *ring = t_logger_ring;
+    if (ring != NULL) {
+        return ring;
+    }
+
+    for (ring = __atomic_load_n(&g_logger_rings, __ATOMIC_ACQUIRE);
+            ring != NULL; ring = ring->next) {
+        int idle = 1;
+        if (__atomic_compare_exchange_n(&ring->idle, &idle, 0, false,
+                    __ATOMIC_ACQUIRE, __ATOMIC_RELAXED)) {
+            t_logger_ring = ring;
+            return ring;
+        }
+    }
+
+    /* mmap() rather than malloc(): the allocator itself logs */
+    ring = mmap(NULL, sizeof(struct logger_ring), PROT_READ | PROT_WRITE,
+            MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    if (ring == MAP_FAILED) {
+        return NULL;
+    }
+    ring->thread = __atomic_add_fetch(&g_logger_threads, 1, __ATOMIC_RELAXED);
+    ring->next = __atomic_load_n(&g_logger_rings, __ATOMIC_RELAXED);
+    while (!__atomic_compare_exchange_n(&g_logger_rings, &ring->next, ring,
+                true, __ATOMIC_RELEASE, __ATOMIC_RELAXED)) {
+    }
+    t_logger_ring = ring;
+    return ring;
+}
+
+/**
+ * void logger_thread_exit(void)
+ *
+ * Hands the calling thread's ring over to the next new thread. Records still
+ * in it are flushed as usual.
+ *
+ * @return void
+ */
+static inline void logger_thread_exit(void)
+{
+    if (t_logger_ring != NULL) {
+        __atomic_store_n(&t_logger_ring->idle, 1, __ATOMIC_RELEASE);
+        t_logger_ring = NULL;
+    }
+}
+
+/**
+ * const char *logger_conversion(const char *c, char *length, char *conversion)
+ *
+ * Parses the conversion specification after a '%': flags, width and
+ * precision are skipped, the length modifier and conversion are returned.
+ *
+ * @param c           first character after the '%'
+ * @param length      receives the last length modifier character, or 0
+ * @param conversion  receives the conversion character
+ * @return c          the character after the conversion
+ */
+static inline const char *logger_conversion(const char *c, char *length, char *conversion)
+{
+    while (*c != '\0' && strchr("-+ #0123456789.", *c) != NULL) {
+        c++;
+    }
+    *length = 0;
+    while (*c != '\0' && strchr("hlqjzt", *c) != NULL) {
+        *length = *c++;
+    }
+    *conversion = *c;
+    return *c == '\0' ? c : c + 1;
+}
+
+/**
+ * void logger_drain(struct logger_buffer *out)
+ *
+ * Writes the output buffer to stderr and empties it.
+ *
+ * @param out         output buffer
+ * @return void
+ */
+static inline void logger_drain(struct logger_buffer *out)
+{
+    size_t written = 0;
+    while (written < out->length) {
+        ssize_t n = write(STDERR_FILENO, out->data + written, out->length - written);
+        if (n <= 0) {
+            break;
+        }
+        written += n;
+    }
+    out->length = 0;
+}
+
+/**
+ * void logger_put(struct logger_buffer *out, const char *str, size_t length)
+ *
+ * Appends to the output buffer, draining it when full.
+ *
+ * @param out         output buffer
+ * @param str         characters to append
+ * @param length      number of characters
+ * @return void
+ */
+static inline void logger_put(struct logger_buffer *out, const char *str, size_t length)
+{
+    while (length > 0) {
+        if (out->length == sizeof(out->data)) {
+            logger_drain(out);
+        }
+        size_t n = sizeof(out->data) - out->length;
+        n = n < length ? n : length;
+        memcpy(out->data + out->length, str, n);
+        out->length += n;
+        str += n;
+        length -= n;
+    }
+}
+
+/**
+ * void logger_number(struct logger_buffer *out, uint64_t value, unsigned int base, int digits)
+ *
+ * Appends an unsigned number, zero padded to at least digits digits.
+ *
+ * @param out         output buffer
+ * @param value       number
+ * @param base        10 or 16
+ * @param digits      minimum number of digits
+ * @return void
+ */
+static inline void logger_number(struct logger_buffer *out, uint64_t value,
+        unsigned int base, int digits)
+{
+    char text[24];
+    int i = sizeof(text);
+    do {
+        text[--i] = "0123456789abcdef"[value % base];
+        value /= base;
+    } while (value != 0 || (int) sizeof(text) - i < digits);
+    logger_put(out, text + i, sizeof(text) - i);
+}
+
+/**
+ * void logger_flush_ring(struct logger_ring *ring, struct logger_buffer *out)
+ *
+ * Formats the ring's pending records into out. The caller holds
+ * g_logger_flush_lock and drains out afterwards.
+ *
+ * @param ring        ring to flush
+ * @param out         output buffer
+ * @return void
+ */
+static inline void logger_flush_ring(struct logger_ring *ring, struct logger_buffer *out)
+{
+    bool color = LOGGER_COLOR && isatty(STDERR_FILENO);
+    uint64_t head = __atomic_load_n(&ring->head, __ATOMIC_ACQUIRE);
+    for (uint64_t tail = ring->tail; tail != head; tail++) {
+        struct logger_record *record = &ring->records[tail & (LOGGER_RECORDS - 1)];
+
+        logger_put(out, "[", 1);
+        logger_number(out, record->time / 1000000000, 10, 1);
+        logger_put(out, ".", 1);
+        logger_number(out, record->time % 1000000000 / 1000, 10, 6);
+        logger_put(out, " T", 2);
+        logger_number(out, ring->thread, 10, 1);
+        logger_put(out, "] ", 2);
+        if (color) {
+            logger_put(out, LOGGER_COLOR_RED, strlen(LOGGER_COLOR_RED));
+        }
+        logger_put(out, record->file, strlen(record->file));
+        if (color) {
+            logger_put(out, LOGGER_COLOR_RESET, strlen(LOGGER_COLOR_RESET));
+        }
+        logger_put(out, ":", 1);
+        logger_number(out, record->line, 10, 1);
+        logger_put(out, ":", 1);
+        if (color) {
+            logger_put(out, LOGGER_COLOR_BLUE, strlen(LOGGER_COLOR_BLUE));
+        }
+        logger_put(out, record->func, strlen(record->func));
+        if (color) {
+            logger_put(out, LOGGER_COLOR_RESET, strlen(LOGGER_COLOR_RESET));
+        }
+        logger_put(out, "(): ", 4);
+
+        /* the format is walked again to give every argument its type back */
+        int count = 0;
+        for (const char *c = record->fmt; *c != '\0'; ) {
+            const char *text = c;
+            while (*c != '\0' && *c != '%') {
+                c++;
+            }
+            logger_put(out, text, c - text);
+            if (*c == '\0') {
+                break;
+            }
+            if (c[1] == '%') {
+                logger_put(out, "%", 1);
+                c += 2;
+                continue;
+            }
+            char length, conversion;
+            c = logger_conversion(c + 1, &length, &conversion);
+            if (count == LOGGER_ARGS) {
+                logger_put(out, "?", 1);
+                continue;
+            }
+            uint64_t value = record->args[count++];
+            bool narrow = length == 0 || length == 'h';
+            switch (conversion) {
+                case 's': {
+                    const char *str = value == 0 ? "(null)" : (const char *) (uintptr_t) value;
+                    logger_put(out, str, strlen(str));
+                    break;
+                }
+                case 'p':
+                    logger_put(out, "0x", 2);
+                    logger_number(out, value, 16, 1);
+                    break;
+                case 'd':
+                case 'i': {
+                    int64_t number = narrow ? (int64_t) (int) value : (int64_t) value;
+                    if (number < 0) {
+                        logger_put(out, "-", 1);
+                    }
+                    logger_number(out, number < 0 ? -(uint64_t) number : (uint64_t) number, 10, 1);
+                    break;
+                }
+                case 'u':
+                    logger_number(out, value, 10, 1);
+                    break;
+                case 'x':
+                case 'X':
+                    logger_number(out, value, 16, 1);
+                    break;
+                case 'c': {
+                    char character = value;
+                    logger_put(out, &character, 1);
+                    break;
+                }
+                default:
+                    /* other conversions (floating point, octal) are not formatted */
+                    logger_put(out, "?", 1);
+                    break;
+            }
+        }
+    }
+    __atomic_store_n(&ring->tail, head, __ATOMIC_RELEASE);
+}
+
+/**
+ * void logger_flush(void)
+ *
+ * Writes out the pending records of every thread, oldest first per thread.
+ *
+ * @return void
+ */
+static inline void logger_flush(void)
+{
+    struct logger_buffer out = { 0 };
+    pthread_mutex_lock(&g_logger_flush_lock);
+    for (struct logger_ring *ring = __atomic_load_n(&g_logger_rings, __ATOMIC_ACQUIRE);
+            ring != NULL; ring = ring->next) {
+        logger_flush_ring(ring, &out);
+    }
+    logger_drain(&out);
+    pthread_mutex_unlock(&g_logger_flush_lock);
+}
+
+/**
+ * void logger_write(const char *file, int line, const char *func, const char *fmt, ...)
+ *
+ * Appends a record to the calling thread's ring, flushing the ring first if
+ * it is full. Arguments are read as the format says, as printf() would.
+ *
+ * @param file        source file
+ * @param line        source line
+ * @param func        function name
+ * @param fmt         printf-style format
+ * @return void
+ */
+static inline __attribute__((format(printf, 4, 5)))
+void logger_write(const char *file, int line, const char *func, const char *fmt, ...)
+{
+    struct logger_ring *ring = logger_ring();
+    if (ring == NULL) {
+        return;
+    }
+    uint64_t head = ring->head;
+    if (head - __atomic_load_n(&ring->tail, __ATOMIC_ACQUIRE) == LOGGER_RECORDS) {
+        struct logger_buffer out = { 0 };
+        pthread_mutex_lock(&g_logger_flush_lock);
+        logger_flush_ring(ring, &out);
+        logger_drain(&out);
+        pthread_mutex_unlock(&g_logger_flush_lock);
+    }
+
+    struct logger_record *record = &ring->records[head & (LOGGER_RECORDS - 1)];
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    record->time = now.tv_sec * 1000000000ULL + now.tv_nsec;
+    record->file = file;
+    record->line = line;
+    record->func = func;
+    record->fmt = fmt;
+
+    va_list ap;
+    va_start(ap, fmt);
+    int count = 0;
+    for (const char *c = fmt; *c != '\0' && count < LOGGER_ARGS; ) {
+        if (*c++ != '%') {
+            continue;
+        }
+        char length, conversion;
+        c = logger_conversion(c, &length, &conversion);
+        switch (conversion) {
+            case 's':
+            case 'p':
+                record->args[count++] = (uintptr_t) va_arg(ap, void *);
+                break;
+            case 'd': case 'i': case 'u': case 'x': case 'X': case 'o': case 'c':
+                if (length == 0 || length == 'h') {
+                    record->args[count++] = va_arg(ap, unsigned int);
+                } else {
+                    record->args[count++] = va_arg(ap, uint64_t);
+                }
+                break;
+            case 'e': case 'f': case 'g': case 'a':
+            case 'E': case 'F': case 'G': case 'A': {
+                double value = va_arg(ap, double);
+                memcpy(&record->args[count++], &value, sizeof(value));
+                break;
+            }
+        }
+    }
+    va_end(ap);
+
+    __atomic_store_n(&ring->head, head + 1, __ATOMIC_RELEASE);
+}
+
+/**
+ * void logger_exit(void)
+ *
+ * Flushes the records still pending when the program exits.
+ *
+ * @return void
+ */
+__attribute__((destructor, unused))
+static void logger_exit(void)
+{
+    logger_flush();
+}
+
+/**
+ * Logs an unformatted log message (single string).
  *
  * Example Usage:
  * LOGP("Hello world!");
  */
 #define LOGP(str) \
-    do { \
-        if (LOGGER) { \
-            if (LOGGER_COLOR) { \
-                if (isatty(STDERR_FILENO)) { \
-                    fprintf(stderr, "%s%s%s:%d:%s%s()%s: %s", \
-                            LOGGER_COLOR_RED, __FILE__, LOGGER_COLOR_RESET, \
-                            __LINE__, \
-                            LOGGER_COLOR_BLUE, __func__, LOGGER_COLOR_RESET, \
-                            str); \
-                    break; \
-                } \
-                fprintf(stderr, "%s:%d:%s(): %s", \
-                        __FILE__, __LINE__, __func__, str); \
-            } \
-        } \
-    } while (0)
-
-/**
- * Prints a formatted log message.
+    logger_write(__FILE__, __LINE__, __func__, "%s", str)
+
+/**
+ * Logs a formatted log message.
  *
  * Example Usage:
  * LOG("Hello %s, your lucky number is %d\n", "World", 42);
  */
 #define LOG(fmt, ...) \
-    do { \
-        if (LOGGER) { \
-            if (LOGGER_COLOR) { \
-                if (isatty(STDERR_FILENO)) { \
-                    fprintf(stderr, "%s%s%s:%d:%s%s()%s: " fmt, \
-                            LOGGER_COLOR_RED, __FILE__, LOGGER_COLOR_RESET, \
-                            __LINE__, \
-                            LOGGER_COLOR_BLUE, __func__, LOGGER_COLOR_RESET, \
-                            __VA_ARGS__); \
-                    break; \
-                } \
-                fprintf(stderr, "%s:%d:%s(): " fmt, __FILE__, \
-                        __LINE__, __func__, __VA_ARGS__); \
-            } \
-        } \
-    } while (0)
+    logger_write(__FILE__, __LINE__, __func__, fmt, __VA_ARGS__)
+
+#else
+
+static inline void logger_thread_exit(void)
+{
+}
+
+static inline void logger_flush(void)
+{
+}
+
+/**
+ * Logging is compiled out: nothing below is evaluated.
+ */
+#define LOGP(str) \
+    do { (void) sizeof(logger_check("%s", str)); } while (0)
+
+#define LOG(fmt, ...) \
+    do { (void) sizeof(logger_check(fmt, __VA_ARGS__)); } while (0)
+
+#endif
 
 #endif
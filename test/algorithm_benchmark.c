@@ -0,0 +1,147 @@
+/**
+ * @file
+ *
+ * Explores memory management at the C runtime level.
+ *
+ * Author: Rozita Teymourzadeh , Allison Wong
+ *
+ * Compares the free space management policies on one random workload:
+ * throughput, and how much of the mapped memory holds requested data at the
+ * end (see algorithm_breakdown.txt). Run once per policy:
+ * ALLOCATOR_TCACHE=0 ALLOCATOR_SLAB=0 ALLOCATOR_ALGORITHM=first_fit ./a.out
+ * ALLOCATOR_TCACHE=0 ALLOCATOR_SLAB=0 ALLOCATOR_ALGORITHM=best_fit ./a.out
+ * ALLOCATOR_TCACHE=0 ALLOCATOR_SLAB=0 ALLOCATOR_ALGORITHM=worst_fit ./a.out
+ * ALLOCATOR_TCACHE=0 ALLOCATOR_SLAB=0 ALLOCATOR_ALGORITHM=buddy ./a.out
+  */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "logger.h"
+#include "allocator.h"
+
+#define SLOTS 4096
+#define OPERATIONS 1000000
+
+static FILE *state; /* opened before the workload so stdio does not allocate during it */
+static char state_buffer[8192];
+
+static char *slots[SLOTS];
+static size_t sizes[SLOTS];
+
+/**
+ * unsigned int next_random(void)
+ *
+ * Small deterministic generator, so every policy sees the same workload.
+ *
+ * @return unsigned int   pseudo-random number
+  */
+static unsigned int next_random(void)
+{
+	static unsigned long seed = 42;
+	seed = seed * 6364136223846793005UL + 1442695040888963407UL;
+	return seed >> 33;
+}
+
+/**
+ * size_t next_size(void)
+ *
+ * Request sizes: mostly small, some medium, a few large.
+ *
+ * @return size_t     request size
+  */
+static size_t next_size(void)
+{
+	unsigned int r = next_random();
+	if (r % 10 < 6) {
+		return 16 + r / 10 % 496;
+	} else if (r % 10 < 9) {
+		return 512 + r / 10 % 3584;
+	}
+	return 4096 + r / 10 % 61440;
+}
+
+/**
+ * void report(FILE *fp, size_t requested)
+ *
+ * Prints the mapped bytes, the requested bytes still live and their ratio,
+ * computed from the memory state.
+ *
+ * @param fp          output file
+ * @param requested   bytes requested by the live allocations
+ * @return void
+  */
+static void report(FILE *fp, size_t requested)
+{
+	rewind(state);
+	ftruncate(fileno(state), 0);
+	save_memory(state);
+	fflush(state);
+	rewind(state);
+
+	char line[1024];
+	size_t mapped = 0, regions = 0;
+	while (fgets(line, sizeof(line), state) != NULL) {
+		size_t size;
+		char *fields = strchr(line, ' ');
+		if (strncmp(line, "[REGION]", 8) != 0 || fields == NULL
+				|| (fields = strchr(fields + 1, ' ')) == NULL
+				|| sscanf(fields + 1, "%zu", &size) != 1) {
+			continue;
+		}
+		regions++;
+		mapped += size;
+	}
+	fprintf(fp, "regions: %zu, mapped: %zu KiB, requested: %zu KiB, utilization: %.2f\n",
+			regions, mapped / 1024, requested / 1024,
+			mapped == 0 ? 0.0 : (double) requested / mapped);
+}
+
+/**
+ * void main()
+ *
+ * Test Driver
+ *
+ * @param void
+ * @return void
+  */
+int main(void)
+{
+	FILE *fp = stderr;
+	state = tmpfile();
+	setvbuf(state, state_buffer, _IOFBF, sizeof(state_buffer));
+
+	char *algorithm = getenv("ALLOCATOR_ALGORITHM");
+	size_t requested = 0;
+	struct timespec start, end;
+	clock_gettime(CLOCK_MONOTONIC, &start);
+	for (int i = 0; i < OPERATIONS; i++) {
+		int slot = next_random() % SLOTS;
+		if (slots[slot] != NULL) {
+			free(slots[slot]);
+			requested -= sizes[slot];
+			slots[slot] = NULL;
+		} else {
+			sizes[slot] = next_size();
+			slots[slot] = malloc(sizes[slot]);
+			slots[slot][0] = 1;
+			requested += sizes[slot];
+		}
+	}
+	clock_gettime(CLOCK_MONOTONIC, &end);
+	double ms = (end.tv_sec - start.tv_sec) * 1e3 + (end.tv_nsec - start.tv_nsec) / 1e6;
+
+	fprintf(fp, "%s: %d operations in %.0f ms (%.0f ops/ms)\n",
+			algorithm == NULL ? "first_fit" : algorithm, OPERATIONS, ms, OPERATIONS / ms);
+	report(fp, requested);
+
+	for (int i = 0; i < SLOTS; i++) {
+		free(slots[i]);
+	}
+	fclose(state);
+
+	return 0;
+}
@@ -0,0 +1,111 @@
+/**
+ * @file
+ *
+ * Explores memory management at the C runtime level.
+ *
+ * Author: Rozita Teymourzadeh , Allison Wong
+ *
+ * Measures building and tearing down many same-size nodes at once, one call
+ * per node against malloc_batch() and free_batch() (see
+ * batch_breakdown.txt). Run:
+ * ./a.out
+ * ALLOCATOR_TCACHE=0 ALLOCATOR_SLAB=0 ./a.out
+  */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "logger.h"
+#include "allocator.h"
+
+#define NODES 100000
+#define ROUNDS 50
+
+static void *nodes[NODES];
+
+/**
+ * double elapsed_ns(struct timespec *start, struct timespec *end)
+ *
+ * Time between two clock readings.
+ *
+ * @param start       first reading
+ * @param end         second reading
+ * @return double     nanoseconds
+  */
+static double elapsed_ns(struct timespec *start, struct timespec *end)
+{
+	return (end->tv_sec - start->tv_sec) * 1e9 + (end->tv_nsec - start->tv_nsec);
+}
+
+/**
+ * void run(FILE *fp, size_t size, int batch)
+ *
+ * Allocates, touches and frees NODES nodes of 'size' bytes ROUNDS times and
+ * prints the time per node.
+ *
+ * @param fp          output file
+ * @param size        node size
+ * @param batch       use malloc_batch() and free_batch()
+ * @return void
+  */
+static void run(FILE *fp, size_t size, int batch)
+{
+	struct timespec start, end;
+	double allocating = 0, freeing = 0;
+	for (int round = 0; round < ROUNDS; round++) {
+		clock_gettime(CLOCK_MONOTONIC, &start);
+		if (batch) {
+			if (malloc_batch(size, NODES, nodes) != NODES) {
+				fprintf(fp, "malloc_batch failed\n");
+				exit(1);
+			}
+		} else {
+			for (int i = 0; i < NODES; i++) {
+				nodes[i] = malloc(size);
+			}
+		}
+		clock_gettime(CLOCK_MONOTONIC, &end);
+		allocating += elapsed_ns(&start, &end);
+
+		for (int i = 0; i < NODES; i++) {
+			memset(nodes[i], i, size);
+		}
+
+		clock_gettime(CLOCK_MONOTONIC, &start);
+		if (batch) {
+			free_batch(nodes, NODES);
+		} else {
+			for (int i = 0; i < NODES; i++) {
+				free(nodes[i]);
+			}
+		}
+		clock_gettime(CLOCK_MONOTONIC, &end);
+		freeing += elapsed_ns(&start, &end);
+	}
+	fprintf(fp, "%4zu bytes, %s: %5.1f ns per malloc, %5.1f ns per free\n",
+			size, batch ? "batch   " : "per call",
+			allocating / ROUNDS / NODES, freeing / ROUNDS / NODES);
+}
+
+/**
+ * void main()
+ *
+ * Test Driver
+ *
+ * @param void
+ * @return void
+  */
+int main(void)
+{
+	FILE *fp = stderr;
+	size_t sizes[] = { 48, 200, 2000 };
+	for (int i = 0; i < 3; i++) {
+		run(fp, sizes[i], 0);
+		run(fp, sizes[i], 1);
+	}
+
+	return 0;
+}
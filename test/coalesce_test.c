@@ -0,0 +1,111 @@
+/**
+ * @file
+ *
+ * Explores memory management at the C runtime level.
+ *
+ * Author: Rozita Teymourzadeh , Allison Wong
+ *
+ * Shows how freed neighbours are coalesced and how that changes
+ * fragmentation. Compare the two modes (see coalesce_breakdown.txt):
+ * ALLOCATOR_TCACHE=0 ALLOCATOR_COALESCE=immediate ./a.out
+ * ALLOCATOR_TCACHE=0 ALLOCATOR_COALESCE=deferred ./a.out
+  */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "logger.h"
+#include "allocator.h"
+
+static FILE *state; /* opened before the scenario so stdio does not allocate during it */
+static char state_buffer[8192];
+
+/**
+ * void report(FILE *fp)
+ *
+ * Prints the memory state followed by a fragmentation summary computed from
+ * it: blocks in the list, free bytes, largest free extent and fragmentation
+ * (1 - largest extent / free bytes).
+ *
+ * @param fp          output file
+ * @return void
+  */
+static void report(FILE *fp)
+{
+	rewind(state);
+	ftruncate(fileno(state), 0);
+	save_memory(state);
+	fflush(state);
+	rewind(state);
+
+	char line[1024];
+	size_t blocks = 0, free_bytes = 0, largest = 0;
+	while (fgets(line, sizeof(line), state) != NULL) {
+		fputs(line, fp);
+		size_t size, usage;
+		char *fields = strrchr(line, '\'');
+		if (strncmp(line, "[BLOCK]", 7) != 0 || fields == NULL
+				|| sscanf(fields + 1, "%zu %zu", &size, &usage) != 2) {
+			continue;
+		}
+		blocks++;
+		free_bytes += size - usage;
+		if (size - usage > largest) {
+			largest = size - usage;
+		}
+	}
+	fprintf(fp, "blocks: %zu, free: %zu, largest extent: %zu, fragmentation: %.2f\n",
+			blocks, free_bytes, largest,
+			free_bytes == 0 ? 0.0 : 1.0 - (double) largest / free_bytes);
+}
+
+/**
+ * void main()
+ *
+ * Test Driver
+ *
+ * @param void
+ * @return void
+  */
+int main(void)
+{
+	FILE *fp = stderr;
+	state = tmpfile();
+	setvbuf(state, state_buffer, _IOFBF, sizeof(state_buffer));
+
+	char *string0 = malloc_name(500, "ALLOCATION 0");
+	char *string1 = malloc_name(1000, "ALLOCATION 1");
+	char *string2 = malloc_name(250, "ALLOCATION 2");
+	char *string3 = malloc_name(290, "ALLOCATION 3");
+	char *string4 = malloc_name(500, "ALLOCATION 4");
+
+	fputs("--------------------------\n", fp);
+	fputs("---Expecting 0, 1, 2, 3, 4---\n", fp);
+	fputs("--------------------------\n", fp);
+	report(fp);
+
+	free(string1);
+	free(string3);
+	free(string2);
+
+	fputs("--------------------------\n", fp);
+	fputs("---Expecting 0, 4 (immediate) or 0, 1, 2, 3, 4 (deferred)---\n", fp);
+	fputs("--------------------------\n", fp);
+	report(fp);
+
+	char *string5 = malloc_name(1500, "ALLOCATION 5");
+
+	fputs("--------------------------\n", fp);
+	fputs("---Expecting 0, 5, 4---\n", fp);
+	fputs("--------------------------\n", fp);
+	report(fp);
+
+	free(string0);
+	free(string4);
+	free(string5);
+	fclose(state);
+
+	return 0;
+}
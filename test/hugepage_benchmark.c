@@ -0,0 +1,130 @@
+/**
+ * @file
+ *
+ * Explores memory management at the C runtime level.
+ *
+ * Author: Rozita Teymourzadeh , Allison Wong
+ *
+ * Measures a TLB-bound workload, a pointer chase in random order over a heap
+ * of small blocks, with and without huge pages (see
+ * hugepage_breakdown.txt). Run:
+ * ./a.out
+ * ALLOCATOR_HUGEPAGE=thp ./a.out
+  */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "logger.h"
+#include "allocator.h"
+
+#define NODES (2 * 1024 * 1024)
+#define HOPS (20 * 1000 * 1000)
+
+struct node {
+	struct node *next;
+	char payload[248];
+};
+
+static FILE *state; /* opened before the workload so stdio does not allocate during it */
+static char state_buffer[8192];
+
+/**
+ * unsigned int next_random(void)
+ *
+ * Small deterministic generator, so every run sees the same workload.
+ *
+ * @return unsigned int   pseudo-random number
+  */
+static unsigned int next_random(void)
+{
+	static unsigned long seed = 5;
+	seed = seed * 6364136223846793005UL + 1442695040888963407UL;
+	return seed >> 33;
+}
+
+/**
+ * void report(FILE *fp)
+ *
+ * Prints the huge page statistics found in the memory state.
+ *
+ * @param fp          output file
+ * @return void
+  */
+static void report(FILE *fp)
+{
+	rewind(state);
+	ftruncate(fileno(state), 0);
+	save_memory(state);
+	fflush(state);
+	rewind(state);
+
+	char line[1024];
+	size_t advised = 0, backed = 0;
+	while (fgets(line, sizeof(line), state) != NULL) {
+		unsigned int arena;
+		size_t bytes;
+		if (sscanf(line, "[HUGE] backed %zu", &bytes) == 1) {
+			backed = bytes;
+		} else if (sscanf(line, "[HUGE] %u %zu", &arena, &bytes) == 2) {
+			advised += bytes;
+		}
+	}
+	fprintf(fp, "huge page regions: %zu MiB, backed by huge pages: %zu MiB\n",
+			advised >> 20, backed >> 20);
+}
+
+/**
+ * void main()
+ *
+ * Test Driver
+ *
+ * @param void
+ * @return void
+  */
+int main(void)
+{
+	FILE *fp = stderr;
+	state = tmpfile();
+	setvbuf(state, state_buffer, _IOFBF, sizeof(state_buffer));
+
+	struct node **nodes = malloc(NODES * sizeof(struct node *));
+	for (int i = 0; i < NODES; i++) {
+		nodes[i] = malloc(sizeof(struct node));
+	}
+	/* link the nodes into one cycle in random order */
+	for (int i = NODES - 1; i > 0; i--) {
+		int j = next_random() % (i + 1);
+		struct node *swap = nodes[i];
+		nodes[i] = nodes[j];
+		nodes[j] = swap;
+	}
+	for (int i = 0; i < NODES; i++) {
+		nodes[i]->next = nodes[(i + 1) % NODES];
+	}
+
+	struct timespec start, end;
+	struct node *current = nodes[0];
+	clock_gettime(CLOCK_MONOTONIC, &start);
+	for (int i = 0; i < HOPS; i++) {
+		current = current->next;
+	}
+	clock_gettime(CLOCK_MONOTONIC, &end);
+	double ns = ((end.tv_sec - start.tv_sec) * 1e9 + (end.tv_nsec - start.tv_nsec)) / HOPS;
+
+	char *mode = getenv("ALLOCATOR_HUGEPAGE");
+	fprintf(fp, "%s: %d hops, %.1f ns per hop (%p)\n",
+			mode == NULL ? "off" : mode, HOPS, ns, (void *) current);
+	report(fp);
+
+	for (int i = 0; i < NODES; i++) {
+		free(nodes[i]);
+	}
+	free(nodes);
+	fclose(state);
+
+	return 0;
+}
@@ -0,0 +1,88 @@
+/**
+ * @file
+ *
+ * Explores memory management at the C runtime level.
+ *
+ * Author: Rozita Teymourzadeh , Allison Wong
+ *
+ * Measures the cost of large allocations that are freed again soon after
+ * use: time and page faults, with and without the large mapping cache (see
+ * large_breakdown.txt). Run:
+ * ./a.out
+ * ALLOCATOR_LARGE_CACHE=0 ./a.out
+ * ALLOCATOR_LARGE_THRESHOLD=0 ./a.out
+  */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/resource.h>
+
+#include "logger.h"
+#include "allocator.h"
+
+#define SLOTS 4
+#define OPERATIONS 20000
+
+static char *slots[SLOTS];
+
+/**
+ * unsigned int next_random(void)
+ *
+ * Small deterministic generator, so every run sees the same workload.
+ *
+ * @return unsigned int   pseudo-random number
+  */
+static unsigned int next_random(void)
+{
+	static unsigned long seed = 11;
+	seed = seed * 6364136223846793005UL + 1442695040888963407UL;
+	return seed >> 33;
+}
+
+/**
+ * void main()
+ *
+ * Test Driver
+ *
+ * @param void
+ * @return void
+  */
+int main(void)
+{
+	FILE *fp = stderr;
+	long page_size = sysconf(_SC_PAGESIZE);
+	struct rusage before, after;
+	struct timespec start, end;
+
+	getrusage(RUSAGE_SELF, &before);
+	clock_gettime(CLOCK_MONOTONIC, &start);
+	for (int i = 0; i < OPERATIONS; i++) {
+		int slot = next_random() % SLOTS;
+		free(slots[slot]);
+		/* 256 KiB to 1 MiB, every page written once */
+		size_t size = 256 * 1024 + next_random() % (768 * 1024);
+		slots[slot] = malloc(size);
+		for (size_t offset = 0; offset < size; offset += page_size) {
+			slots[slot][offset] = 1;
+		}
+	}
+	clock_gettime(CLOCK_MONOTONIC, &end);
+	getrusage(RUSAGE_SELF, &after);
+	double ms = (end.tv_sec - start.tv_sec) * 1e3 + (end.tv_nsec - start.tv_nsec) / 1e6;
+
+	char *cache = getenv("ALLOCATOR_LARGE_CACHE");
+	char *threshold = getenv("ALLOCATOR_LARGE_THRESHOLD");
+	fprintf(fp, "threshold %s, cache %s: %d operations in %.0f ms, %ld page faults\n",
+			threshold == NULL ? "default" : threshold,
+			cache == NULL ? "default" : cache,
+			OPERATIONS, ms, after.ru_minflt - before.ru_minflt);
+
+	for (int i = 0; i < SLOTS; i++) {
+		free(slots[i]);
+	}
+
+	return 0;
+}
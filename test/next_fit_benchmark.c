@@ -0,0 +1,133 @@
+/**
+ * @file
+ *
+ * Explores memory management at the C runtime level.
+ *
+ * Author: Rozita Teymourzadeh , Allison Wong
+ *
+ * Measures how many blocks next_fit visits per request on a heap whose start
+ * is filled with long-lived blocks and small holes, while the rest of the
+ * heap churns (see next_fit_breakdown.txt). Build once as is and once with
+ * -DNEXT_FIT_RESTART (every search starts at the first region, like a list
+ * walking first fit), then run:
+ * ALLOCATOR_TCACHE=0 ALLOCATOR_SLAB=0 ALLOCATOR_ALGORITHM=next_fit ./a.out
+ * ALLOCATOR_TCACHE=0 ALLOCATOR_SLAB=0 ALLOCATOR_ALGORITHM=first_fit ./a.out
+  */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "logger.h"
+#include "allocator.h"
+
+#define LONG_LIVED 20000
+#define SLOTS 1024
+#define OPERATIONS 200000
+
+static FILE *state; /* opened before the workload so stdio does not allocate during it */
+static char state_buffer[8192];
+
+static char *long_lived[LONG_LIVED];
+static char *slots[SLOTS];
+
+/**
+ * unsigned int next_random(void)
+ *
+ * Small deterministic generator, so every run sees the same workload.
+ *
+ * @return unsigned int   pseudo-random number
+  */
+static unsigned int next_random(void)
+{
+	static unsigned long seed = 7;
+	seed = seed * 6364136223846793005UL + 1442695040888963407UL;
+	return seed >> 33;
+}
+
+/**
+ * void report(FILE *fp)
+ *
+ * Prints the next_fit search statistics found in the memory state.
+ *
+ * @param fp          output file
+ * @return void
+  */
+static void report(FILE *fp)
+{
+	rewind(state);
+	ftruncate(fileno(state), 0);
+	save_memory(state);
+	fflush(state);
+	rewind(state);
+
+	char line[1024];
+	unsigned long requests = 0, visits = 0;
+	while (fgets(line, sizeof(line), state) != NULL) {
+		unsigned long r, v;
+		void *rover;
+		if (sscanf(line, "[ROVER] %p %lu %lu", &rover, &r, &v) == 3) {
+			requests += r;
+			visits += v;
+		}
+	}
+	if (requests != 0) {
+		fprintf(fp, "searches: %lu, blocks visited: %lu, per search: %.1f\n",
+				requests, visits, (double) visits / requests);
+	}
+}
+
+/**
+ * void main()
+ *
+ * Test Driver
+ *
+ * @param void
+ * @return void
+  */
+int main(void)
+{
+	FILE *fp = stderr;
+	state = tmpfile();
+	setvbuf(state, state_buffer, _IOFBF, sizeof(state_buffer));
+
+	/* long-lived head: small blocks, every fourth one freed again */
+	for (int i = 0; i < LONG_LIVED; i++) {
+		long_lived[i] = malloc(64 + next_random() % 192);
+	}
+	for (int i = 0; i < LONG_LIVED; i += 4) {
+		free(long_lived[i]);
+		long_lived[i] = NULL;
+	}
+
+	char *algorithm = getenv("ALLOCATOR_ALGORITHM");
+	struct timespec start, end;
+	clock_gettime(CLOCK_MONOTONIC, &start);
+	for (int i = 0; i < OPERATIONS; i++) {
+		int slot = next_random() % SLOTS;
+		if (slots[slot] != NULL) {
+			free(slots[slot]);
+			slots[slot] = NULL;
+		} else {
+			slots[slot] = malloc(512 + next_random() % 1536);
+		}
+	}
+	clock_gettime(CLOCK_MONOTONIC, &end);
+	double ms = (end.tv_sec - start.tv_sec) * 1e3 + (end.tv_nsec - start.tv_nsec) / 1e6;
+
+	fprintf(fp, "%s: %d operations in %.0f ms\n",
+			algorithm == NULL ? "first_fit" : algorithm, OPERATIONS, ms);
+	report(fp);
+
+	for (int i = 0; i < SLOTS; i++) {
+		free(slots[i]);
+	}
+	for (int i = 0; i < LONG_LIVED; i++) {
+		free(long_lived[i]);
+	}
+	fclose(state);
+
+	return 0;
+}
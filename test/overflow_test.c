@@ -0,0 +1,102 @@
+/**
+ * @file
+ *
+ * Explores memory management at the C runtime level.
+ *
+ * Author: Rozita Teymourzadeh , Allison Wong
+ *
+ * Requests sizes near SIZE_MAX, where adding the block header wraps around.
+ * Every request must fail with ENOMEM instead of returning a small block, and
+ * a failed realloc() must leave the old block intact. Run:
+ * ./a.out
+ * ALLOCATOR_LARGE_THRESHOLD=0 ./a.out
+  */
+
+#include <errno.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "logger.h"
+#include "allocator.h"
+
+static int failures = 0;
+
+/**
+ * void check(FILE *fp, const char *call, size_t size, void *ptr, int error)
+ *
+ * Reports one request and counts it as a failure unless it returned NULL
+ * with errno ENOMEM. A block returned by mistake is freed.
+ *
+ * @param fp          output file
+ * @param call        function called
+ * @param size        size requested
+ * @param ptr         pointer returned
+ * @param error       errno after the call
+ * @return void
+  */
+static void check(FILE *fp, const char *call, size_t size, void *ptr, int error)
+{
+	bool ok = ptr == NULL && error == ENOMEM;
+	fprintf(fp, "%-8s SIZE_MAX - %-6zu -> %p, errno %d %s\n",
+			call, SIZE_MAX - size, ptr, error, ok ? "OK" : "FAIL");
+	if (!ok) {
+		failures++;
+		free(ptr);
+	}
+}
+
+/**
+ * void main()
+ *
+ * Test Driver
+ *
+ * @param void
+ * @return void
+  */
+int main(void)
+{
+	FILE *fp = stderr;
+	size_t sizes[] = { SIZE_MAX, SIZE_MAX - 1, SIZE_MAX - 60, SIZE_MAX - 4096,
+		SIZE_MAX - 2 * 1024 * 1024 };
+
+	/* leaves free space behind it, where a wrapped size would fit */
+	char *keep = malloc(5000);
+
+	fputs("--------------------------\n", fp);
+	fputs("---Expecting NULL with errno 12 (ENOMEM) for every request---\n", fp);
+	fputs("--------------------------\n", fp);
+	for (int i = 0; i < 5; i++) {
+		errno = 0;
+		void *ptr = malloc(sizes[i]);
+		check(fp, "malloc", sizes[i], ptr, errno);
+
+		errno = 0;
+		ptr = calloc(1, sizes[i]);
+		check(fp, "calloc", sizes[i], ptr, errno);
+
+		char *blocks[] = { malloc(10), malloc(5000) };
+		for (int j = 0; j < 2; j++) {
+			strcpy(blocks[j], "UNCHANGED");
+			errno = 0;
+			ptr = realloc(blocks[j], sizes[i]);
+			int error = errno;
+			if (ptr != NULL) {
+				check(fp, "realloc", sizes[i], ptr, error);
+				continue;
+			}
+			check(fp, "realloc", sizes[i], NULL, error);
+			if (strcmp(blocks[j], "UNCHANGED") != 0) {
+				fputs("old block changed by a failed realloc: FAIL\n", fp);
+				failures++;
+			}
+			free(blocks[j]);
+		}
+	}
+
+	free(keep);
+	fprintf(fp, "%d failures\n", failures);
+	return failures == 0 ? 0 : 1;
+}
@@ -0,0 +1,136 @@
+/**
+ * @file
+ *
+ * Explores memory management at the C runtime level.
+ *
+ * Author: Rozita Teymourzadeh , Allison Wong
+ *
+ * Measures how resident memory follows live data once most of the heap is
+ * freed, and what purging costs the free() calls (see purge_breakdown.txt).
+ * Run:
+ * ALLOCATOR_PURGE=off ./a.out
+ * ALLOCATOR_DECAY_MS=100 ./a.out
+ * ALLOCATOR_DECAY_MS=100 ALLOCATOR_PURGE_THREAD=1 ./a.out
+  */
+
+#include <fcntl.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "logger.h"
+#include "allocator.h"
+
+#define BLOCKS 100000
+#define KEEP 10 /* one block in KEEP stays live */
+
+static char *blocks[BLOCKS];
+
+/**
+ * unsigned int next_random(void)
+ *
+ * Small deterministic generator, so every run sees the same workload.
+ *
+ * @return unsigned int   pseudo-random number
+  */
+static unsigned int next_random(void)
+{
+	static unsigned long seed = 3;
+	seed = seed * 6364136223846793005UL + 1442695040888963407UL;
+	return seed >> 33;
+}
+
+/**
+ * long resident_mib(void)
+ *
+ * Reads the resident set size without allocating.
+ *
+ * @return long       resident memory in MiB
+  */
+static long resident_mib(void)
+{
+	char buffer[128];
+	int fd = open("/proc/self/statm", O_RDONLY);
+	ssize_t length = read(fd, buffer, sizeof(buffer) - 1);
+	close(fd);
+	buffer[length < 0 ? 0 : length] = '\0';
+	long pages = 0, resident = 0;
+	sscanf(buffer, "%ld %ld", &pages, &resident);
+	return resident * sysconf(_SC_PAGESIZE) >> 20;
+}
+
+/**
+ * double elapsed_ns(struct timespec *start, struct timespec *end)
+ *
+ * Time between two clock readings.
+ *
+ * @param start       first reading
+ * @param end         second reading
+ * @return double     nanoseconds
+  */
+static double elapsed_ns(struct timespec *start, struct timespec *end)
+{
+	return (end->tv_sec - start->tv_sec) * 1e9 + (end->tv_nsec - start->tv_nsec);
+}
+
+/**
+ * void main()
+ *
+ * Test Driver
+ *
+ * @param void
+ * @return void
+  */
+int main(void)
+{
+	FILE *fp = stderr;
+	for (int i = 0; i < BLOCKS; i++) {
+		size_t size = 1024 + next_random() % 7168;
+		blocks[i] = malloc(size);
+		memset(blocks[i], 1, size);
+	}
+	long peak = resident_mib();
+
+	/* free all but every KEEP-th block, timing each free() */
+	struct timespec start, end;
+	double total = 0, slowest = 0;
+	for (int i = 0; i < BLOCKS; i++) {
+		if (i % KEEP == 0) {
+			continue;
+		}
+		clock_gettime(CLOCK_MONOTONIC, &start);
+		free(blocks[i]);
+		clock_gettime(CLOCK_MONOTONIC, &end);
+		double ns = elapsed_ns(&start, &end);
+		total += ns;
+		slowest = ns > slowest ? ns : slowest;
+	}
+	long freed = resident_mib();
+
+	/* stay idle for a while, then touch the heap a little */
+	struct timespec pause = { 0, 500 * 1000 * 1000 };
+	nanosleep(&pause, NULL);
+	long idle = resident_mib();
+	for (int i = 0; i < 2048; i++) {
+		char *volatile block = malloc(2048); /* volatile: keep the pair */
+		free(block);
+	}
+	long active = resident_mib();
+
+	char *purge = getenv("ALLOCATOR_PURGE");
+	char *thread = getenv("ALLOCATOR_PURGE_THREAD");
+	fprintf(fp, "purge %s%s: peak %ld MiB, after free %ld MiB, idle %ld MiB, active %ld MiB; "
+			"free() %.0f ns average, %.0f ns slowest\n",
+			purge == NULL ? "dontneed" : purge,
+			thread != NULL && strcmp(thread, "1") == 0 ? " (thread)" : "",
+			peak, freed, idle, active,
+			total / (BLOCKS - BLOCKS / KEEP), slowest);
+
+	for (int i = 0; i < BLOCKS; i += KEEP) {
+		free(blocks[i]);
+	}
+
+	return 0;
+}
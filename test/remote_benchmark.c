@@ -0,0 +1,121 @@
+/**
+ * @file
+ *
+ * Explores memory management at the C runtime level.
+ *
+ * Author: Rozita Teymourzadeh , Allison Wong
+ *
+ * Measures a producer/consumer pipeline: producer threads allocate messages
+ * and hand them to consumer threads, which free them, so nearly every free()
+ * is made by a thread other than the one that allocated the memory (see
+ * remote_breakdown.txt). Run:
+ * ./a.out
+ * ALLOCATOR_TCACHE=0 ./a.out
+  */
+
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "logger.h"
+#include "allocator.h"
+
+#define PAIRS 4
+#define MESSAGES 1000000 /* per pair */
+#define RING 1024 /* messages in flight per pair */
+
+struct ring {
+	void *slots[RING];
+	unsigned long head; /* written by the producer */
+	unsigned long tail __attribute__((aligned(64))); /* written by the consumer */
+	size_t size;
+} __attribute__((aligned(64)));
+
+static struct ring rings[PAIRS];
+
+/**
+ * void *produce(void *arg)
+ *
+ * Allocates and writes messages, then publishes them on the ring.
+ *
+ * @param arg         the pair's ring
+ * @return void       NULL
+  */
+static void *produce(void *arg)
+{
+	struct ring *ring = arg;
+	for (unsigned long i = 0; i < MESSAGES; i++) {
+		size_t size = ring->size + i % 8 * 8;
+		char *message = malloc(size);
+		message[0] = 1;
+		message[size - 1] = 1;
+		while (i - __atomic_load_n(&ring->tail, __ATOMIC_ACQUIRE) >= RING) {
+			sched_yield();
+		}
+		ring->slots[i % RING] = message;
+		__atomic_store_n(&ring->head, i + 1, __ATOMIC_RELEASE);
+	}
+	return NULL;
+}
+
+/**
+ * void *consume(void *arg)
+ *
+ * Takes messages off the ring and frees them.
+ *
+ * @param arg         the pair's ring
+ * @return void       NULL
+  */
+static void *consume(void *arg)
+{
+	struct ring *ring = arg;
+	for (unsigned long i = 0; i < MESSAGES; i++) {
+		while (__atomic_load_n(&ring->head, __ATOMIC_ACQUIRE) == i) {
+			sched_yield();
+		}
+		free(ring->slots[i % RING]);
+		__atomic_store_n(&ring->tail, i + 1, __ATOMIC_RELEASE);
+	}
+	return NULL;
+}
+
+/**
+ * void main()
+ *
+ * Test Driver
+ *
+ * @param void
+ * @return void
+  */
+int main(void)
+{
+	FILE *fp = stderr;
+	size_t sizes[] = { 32, 256, 2048 };
+	for (int s = 0; s < 3; s++) {
+		pthread_t producers[PAIRS], consumers[PAIRS];
+		struct timespec start, end;
+		clock_gettime(CLOCK_MONOTONIC, &start);
+		for (int i = 0; i < PAIRS; i++) {
+			rings[i].head = rings[i].tail = 0;
+			rings[i].size = sizes[s];
+			pthread_create(&producers[i], NULL, produce, &rings[i]);
+			pthread_create(&consumers[i], NULL, consume, &rings[i]);
+		}
+		for (int i = 0; i < PAIRS; i++) {
+			pthread_join(producers[i], NULL);
+			pthread_join(consumers[i], NULL);
+		}
+		clock_gettime(CLOCK_MONOTONIC, &end);
+		double ns = (end.tv_sec - start.tv_sec) * 1e9 + (end.tv_nsec - start.tv_nsec);
+
+		char *tcache = getenv("ALLOCATOR_TCACHE");
+		fprintf(fp, "%zu-%zu bytes, tcache %s: %d pairs, %.0f ns per message\n",
+				sizes[s], sizes[s] + 56, tcache == NULL ? "default" : tcache,
+				PAIRS, ns / ((double) PAIRS * MESSAGES));
+	}
+
+	return 0;
+}